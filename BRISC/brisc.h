@@ -0,0 +1,247 @@
+/*
+  Simulates BRISC level 0 machine code in C++, fast enough to run real
+  programs (see README.md for the instruction set, and sim.html for the
+  browser version this follows).
+
+  Each instruction's 8-bit opcode indexes a table of 256 handler
+  functions, so there's no switch in the inner loop; the MEM operation
+  digit M indexes a second table.  Opcodes above level 0 (and MEM ops
+  other than read, write, and swap) go to a handler that stops with a
+  fatal error: this simulator doesn't run the level 1 decode frames.
+
+  Registers are 32-bit, and arithmetic wraps around like the hardware.
+  Writes to r0 are ignored.  Memory is memsize words, and reads of
+  memory nobody wrote return 0.  Code lives in memory too, so programs
+  can write new instructions and run them.
+
+  Level 0 has no halt instruction, so run stops when an instruction
+  jumps to itself, like add(rF,rF,r0,-1), or after a step limit.
+
+  Dr. Orion Lawlor and the CS 601 class, 2026-02 (Public Domain)
+*/
+#ifndef BRISC_H
+#define BRISC_H
+
+#include <vector>
+#include <utility>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+typedef uint32_t word_t; // registers, memory, and instructions
+
+// Decoded fields of one instruction:
+//  0xop d a b ccc, where ccc is also M I N, and IN is its low 8 bits
+struct brisc_fields {
+	word_t op, d, a, b; // opcode and register numbers
+	int32_t ccc; // 12-bit constant, sign extended
+	word_t M, I, N; // the three digits of ccc, for NAND and MEM
+	int32_t IN; // 8-bit memory offset, sign extended
+
+	brisc_fields(word_t inst) {
+		op = 0xFF & (inst >> 24);
+		d = 0xF & (inst >> 20);
+		a = 0xF & (inst >> 16);
+		b = 0xF & (inst >> 12);
+		ccc = ((int32_t)inst<<20)>>20; // hardware sign-extend
+		M = 0xF & (inst >> 8);
+		I = 0xF & (inst >> 4);
+		N = 0xF & (inst >> 0);
+		IN = ((int32_t)inst<<24)>>24;
+	}
+};
+
+template <long memsize=0x10000>
+class BRISC_machine {
+public:
+	enum {
+		reg_stack = 0xA, // stack pointer (by convention)
+		reg_link = 0xE, // return address
+		reg_pc = 0xF // program counter
+	};
+	word_t regs[16]={0};
+
+	// RAM memory: code and data
+	std::vector<word_t> mem;
+
+	BRISC_machine() :mem(memsize,0) {}
+
+	// Copy this code into memory at addr, and start running there
+	void load(const word_t *code,long n_inst,word_t addr=0)
+	{
+		if (addr+n_inst > memsize) fatal(0,"Program doesn't fit in memory");
+		for (long i=0;i<n_inst;i++) mem[addr+i]=code[i];
+		for (int r=0;r<16;r++) regs[r]=0;
+		regs[reg_pc]=addr;
+	}
+
+	// Run up to max_steps instructions.  Returns the number run, which is
+	//   less than max_steps if an instruction jumped to itself.
+	long run(long max_steps)
+	{
+		const handler_fn *table = handlers();
+		word_t *r = regs;
+		for (long step=0;step<max_steps;step++) {
+			word_t pc = r[reg_pc];
+			if (pc>=(word_t)memsize) fatal(0,"Fetch outside memory");
+			word_t inst = mem[pc];
+			r[reg_pc] = pc+1; //<- real machine has moved to next instruction
+
+			table[inst>>24](*this,inst);
+			r[0] = 0; // writes to the zero register are ignored
+
+			if (r[reg_pc]==pc) return step+1; // jumped to itself: halt
+		}
+		return max_steps;
+	}
+
+	void fatal(word_t inst,const char *why) {
+		printf("Fatal error: %s (inst %08x at addr %08x)\n",
+			why,inst,regs[reg_pc]);
+		exit(1);
+	}
+
+
+	/**************** Level 0 instructions *****************/
+	typedef void (*handler_fn)(BRISC_machine &m,word_t inst);
+
+	static word_t rotate_right(word_t v,word_t dist) {
+		dist &= 31;
+		return (v>>dist) | (v<<((32-dist)&31));
+	}
+
+	// 0x0A ADD: r[d] = r[a] + r[b] + ccc
+	static void op_add(BRISC_machine &m,word_t inst) {
+		brisc_fields f(inst);
+		m.regs[f.d] = m.regs[f.a] + m.regs[f.b] + (word_t)f.ccc;
+	}
+
+	// 0x0B ROT: r[d] = rotate_right(r[a], r[b] + ccc)
+	static void op_rot(BRISC_machine &m,word_t inst) {
+		brisc_fields f(inst);
+		m.regs[f.d] = rotate_right(m.regs[f.a], m.regs[f.b] + (word_t)f.ccc);
+	}
+
+	// 0x0C CSWAP: if (r[b] >= ccc) swap(r[d], r[a]), a signed compare
+	static void op_cswap(BRISC_machine &m,word_t inst) {
+		brisc_fields f(inst);
+		if ((int32_t)m.regs[f.b] >= f.ccc) std::swap(m.regs[f.d], m.regs[f.a]);
+	}
+
+	// 0x0D NAND: r[d] = cnot(nand(cnot(r[a],I), cnot(r[b],N)), M)
+	static void op_nand(BRISC_machine &m,word_t inst) {
+		brisc_fields f(inst);
+		word_t a = m.regs[f.a] ^ (f.I ? ~0u : 0u);
+		word_t b = m.regs[f.b] ^ (f.N ? ~0u : 0u);
+		m.regs[f.d] = ~(a & b) ^ (f.M ? ~0u : 0u);
+	}
+
+	// 0x0E MEM: memory op M between r[d] and mem[r[a] + IN]
+	static void op_mem(BRISC_machine &m,word_t inst) {
+		brisc_fields f(inst);
+		if (f.b!=0) m.fatal(inst,"Bad buffer ID b in MEM");
+		word_t addr = m.regs[f.a] + (word_t)f.IN;
+		if (addr>=(word_t)memsize) m.fatal(inst,"Bad mem addr"); // unsigned compare checks both ends
+		mem_ops()[f.M](m.regs[f.d], m.mem[addr], inst, m);
+	}
+
+	// Anything else isn't level 0
+	static void op_unknown(BRISC_machine &m,word_t inst) {
+		m.fatal(inst,"Unknown opcode (not level 0)");
+	}
+
+	// The decode table: opcode -> handler
+	static const handler_fn *handlers() {
+		static handler_fn table[256];
+		static bool ready=false;
+		if (!ready) {
+			for (int op=0;op<256;op++) table[op]=op_unknown;
+			table[0x0A]=op_add;
+			table[0x0B]=op_rot;
+			table[0x0C]=op_cswap;
+			table[0x0D]=op_nand;
+			table[0x0E]=op_mem;
+			ready=true;
+		}
+		return table;
+	}
+
+	// MEM operations, by M digit
+	typedef void (*mem_fn)(word_t &reg,word_t &mem,word_t inst,BRISC_machine &m);
+	static void mem_read(word_t &reg,word_t &mem,word_t,BRISC_machine &) { reg = mem; }
+	static void mem_write(word_t &reg,word_t &mem,word_t,BRISC_machine &) { mem = reg; }
+	static void mem_swap(word_t &reg,word_t &mem,word_t,BRISC_machine &) { std::swap(reg,mem); }
+	static void mem_unknown(word_t &,word_t &,word_t inst,BRISC_machine &m) {
+		m.fatal(inst,"Bad memory op M");
+	}
+	static const mem_fn *mem_ops() {
+		static const mem_fn table[16]={mem_read, mem_write, mem_swap,
+			mem_unknown, mem_unknown, mem_unknown, mem_unknown, mem_unknown,
+			mem_unknown, mem_unknown, mem_unknown, mem_unknown,
+			mem_unknown, mem_unknown, mem_unknown, mem_unknown};
+		return table;
+	}
+};
+
+
+/* BRISC assembler, with the same names as sim.html's:
+     std::vector<word_t> code = { BRISC::set(BRISC::r3,123), BRISC::inc(BRISC::r3) };
+*/
+namespace BRISC {
+	enum { r0=0, r1, r2, r3, r4, r5, r6, r7, r8, r9, rA, rB, rC, rD, rE, rF };
+
+	// Machine code for opcode with these fields
+	inline word_t asm_inst(int opcode,int d,int a,int b,int ccc) {
+		if (ccc>=(1<<11) || ccc<-(1<<11)) {
+			printf("Fatal error: constant %d doesn't fit in 12 bits\n",ccc);
+			exit(1);
+		}
+		return ((word_t)opcode<<24) | (d<<20) | (a<<16) | (b<<12) | (ccc & 0xfff);
+	}
+
+	inline word_t add(int d,int a,int b,int ccc=0) { return asm_inst(0x0A,d,a,b,ccc); }
+	inline word_t rot(int d,int a,int b,int ccc=0) { return asm_inst(0x0B,d,a,b,ccc); }
+	inline word_t swapcond(int d,int a,int b,int ccc) { return asm_inst(0x0C,d,a,b,ccc); }
+	inline word_t nand(int d,int a,int b,int MIN=0) { return asm_inst(0x0D,d,a,b,MIN); }
+
+	inline word_t set(int dest,int value) { return add(dest,0,0,value); }
+	inline word_t mov(int dest,int src) { return add(dest,src,0,0); }
+	inline word_t inc(int d,int ccc=1) { return add(d,d,0,ccc); }
+	inline word_t dec(int d,int ccc=-1) { return add(d,d,0,ccc); }
+	inline word_t jump(int addr) { return set(rF,addr); }
+	inline word_t jumpreg(int t) { return mov(rF,t); }
+	inline word_t callE() { return swapcond(rF,rE,0,0); } // call the function at rE
+	inline word_t ret() { return swapcond(rE,rF,0,0); } // return to rE
+	inline word_t halt() { return add(rF,rF,0,-1); } // jump to itself
+	inline word_t not_(int d,int src) { return nand(d,src,0,0x001); }
+
+	// Memory operation M on register valueReg and mem[addressReg + addressConst]
+	inline word_t memoryOp(int valueReg,int addressReg,int addressConst,int M) {
+		if (addressConst>=(1<<7) || addressConst<-(1<<7)) {
+			printf("Fatal error: address constant %d doesn't fit in 8 bits\n",addressConst);
+			exit(1);
+		}
+		return asm_inst(0x0E,valueReg,addressReg,0,(M<<8)|(0xFF&addressConst));
+	}
+	inline word_t read(int valueReg,int addressReg,int addressConst=0) { return memoryOp(valueReg,addressReg,addressConst,0); }
+	inline word_t write(int valueReg,int addressReg,int addressConst=0) { return memoryOp(valueReg,addressReg,addressConst,1); }
+	inline word_t swapmem(int valueReg,int addressReg,int addressConst=0) { return memoryOp(valueReg,addressReg,addressConst,2); }
+}
+
+// Read a BRISC program from a binary file of little-endian 32-bit instructions
+inline std::vector<word_t> read_brisc_program(const char *filename)
+{
+	FILE *f = fopen(filename,"rb");
+	if (!f) {
+		printf("Fatal error: can't open program file %s\n",filename);
+		exit(1);
+	}
+	std::vector<word_t> program;
+	unsigned char b[4];
+	while (fread(b,1,4,f)==4)
+		program.push_back(b[0] | (b[1]<<8) | (b[2]<<16) | ((word_t)b[3]<<24));
+	fclose(f);
+	return program;
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+  Measures how many BRISC level 0 instructions per second the C++
+  simulator in brisc.h runs, on loops made of the README's idioms:
+    copy: register copies, add(d,a,0,0)
+    increment: add(d,d,0,1)
+    call/return: calls through rE, to a function that returns with a swap
+    memory: reads and writes through a pointer register
+
+  Build and run with:
+    make benchmark
+  or
+    ./brisc_benchmark [ iterations ]
+
+  Dr. Orion Lawlor and the CS 601 class, 2026-02 (Public Domain)
+*/
+#include <chrono>
+#include <string>
+#include "brisc.h"
+
+using namespace BRISC;
+
+typedef BRISC_machine<0x10000> machine_t;
+
+// Seconds since some arbitrary start point
+double time_now(void) {
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A loop around this body, counting r1 down to zero, then halting.
+//   Code after the halt (like functions the body calls) goes in tail.
+std::vector<word_t> counted_loop(const std::vector<word_t> &body,
+	const std::vector<word_t> &tail=std::vector<word_t>())
+{
+	std::vector<word_t> code(body);
+	code.push_back(dec(r1));
+	int start = -(int)(code.size()+1); // rF is already past the next add
+	code.push_back(add(r9,rF,0,start)); // r9 = loop start (PC-relative)
+	code.push_back(swapcond(rF,r9,r1,1)); // loop while r1 >= 1
+	code.push_back(halt());
+	code.insert(code.end(),tail.begin(),tail.end());
+	return code;
+}
+
+// Repeat these instructions n times
+std::vector<word_t> repeat(const std::vector<word_t> &insts,int n) {
+	std::vector<word_t> code;
+	for (int i=0;i<n;i++) code.insert(code.end(),insts.begin(),insts.end());
+	return code;
+}
+
+// Run this program for this many loop iterations, and report its speed.
+//   check is the register that ends up with a known value, and its value.
+void benchmark(const std::string &name,const std::vector<word_t> &code,
+	long iterations,int check,word_t expected)
+{
+	machine_t m;
+	m.load(code.data(),code.size());
+	m.regs[r1]=iterations;
+	double start=time_now();
+	long steps=m.run(1L<<62);
+	double t=time_now()-start;
+	printf("%-12s %12ld instructions in %7.3f s: %7.1f M instructions/sec%s\n",
+		name.c_str(),steps,t,steps*1.0e-6/t,
+		m.regs[check]==expected ? "" : "  WRONG RESULT");
+}
+
+int main(int argc,char *argv[])
+{
+	long n = 10000000;
+	if (argc>1) n = atol(argv[1]);
+	const int unroll=8; // idiom instructions per loop iteration
+
+	// Copy: rotate values through r2, r3, r4
+	benchmark("copy", counted_loop(repeat({mov(r2,r3), mov(r3,r4), mov(r4,r2)},unroll)),
+		n, r2, 0);
+
+	// Increment: r2 counts up
+	benchmark("increment", counted_loop(repeat({inc(r2)},unroll)),
+		n, r2, (word_t)(n*unroll));
+
+	// Call/return: each call point rE at the function (PC-relative),
+	//   and the function bumps r2 and returns.
+	std::vector<word_t> calls;
+	for (int i=0;i<unroll;i++) {
+		int function = 2*unroll + 4; // after the loop control and halt
+		calls.push_back(add(rE,rF,0,function-(2*i+1))); // rE = function
+		calls.push_back(callE());
+	}
+	benchmark("call/return", counted_loop(calls, {inc(r2), ret()}),
+		n, r2, (word_t)(n*unroll));
+
+	// Memory: store r2 to mem[r5], read it back into r3, and bump it
+	std::vector<word_t> mem_body = {set(r5,0x700)};
+	for (int i=0;i<unroll;i++) {
+		mem_body.push_back(write(r2,r5,i));
+		mem_body.push_back(read(r3,r5,i));
+		mem_body.push_back(inc(r2));
+	}
+	benchmark("memory", counted_loop(mem_body), n, r3, (word_t)(n*unroll-1));
+	return 0;
+}
@@ -0,0 +1,51 @@
+; Vectorizable loops: fill memory with i*arg0, then repeatedly
+; sum up mem[i]*(i+r).  The loop vectorizer turns these into SIMD
+; instructions, as wide as the target CPU supports.  Compare:
+;    ./jit ../llvm/examples/vector.ll
+;    ./jit -novec ../llvm/examples/vector.ll
+;    ./jit -mcpu=x86-64 ../llvm/examples/vector.ll
+
+@jitmemsize = constant i32 65536 ; number of i32 in mem
+
+define i64 @jitentry(i64 %arg0, i32* %mem) {
+entry:
+  %a = trunc i64 %arg0 to i32
+  br label %fill
+
+fill: ; mem[i] = i*a
+  %i = phi i64 [ 0, %entry ], [ %inext, %fill ]
+  %i32 = trunc i64 %i to i32
+  %v = mul i32 %i32, %a
+  %p = getelementptr inbounds i32, i32* %mem, i64 %i
+  store i32 %v, i32* %p, align 4
+  %inext = add nuw nsw i64 %i, 1
+  %fillmore = icmp ult i64 %inext, 65536
+  br i1 %fillmore, label %fill, label %repeat
+
+repeat: ; for r from 0 to 1000
+  %r = phi i32 [ 0, %fill ], [ %rnext, %sumdone ]
+  %total = phi i32 [ 0, %fill ], [ %sumnext, %sumdone ]
+  br label %sum
+
+sum: ; total += mem[j]*(j+r)
+  %j = phi i64 [ 0, %repeat ], [ %jnext, %sum ]
+  %s = phi i32 [ %total, %repeat ], [ %sumnext, %sum ]
+  %q = getelementptr inbounds i32, i32* %mem, i64 %j
+  %m = load i32, i32* %q, align 4
+  %j32 = trunc i64 %j to i32
+  %jr = add i32 %j32, %r
+  %prod = mul i32 %m, %jr
+  %sumnext = add i32 %s, %prod
+  %jnext = add nuw nsw i64 %j, 1
+  %summore = icmp ult i64 %jnext, 65536
+  br i1 %summore, label %sum, label %sumdone
+
+sumdone:
+  %rnext = add nuw nsw i32 %r, 1
+  %repeatmore = icmp ult i32 %rnext, 1000
+  br i1 %repeatmore, label %repeat, label %done
+
+done:
+  %result = sext i32 %sumnext to i64
+  ret i64 %result
+}
@@ -0,0 +1,636 @@
+/*
+  Translates BRISC level 0 machine code to LLVM IR, printed to stdout.
+  (BRISC is in ../BRISC: see README.md there, and brisc.h for the simulator.)
+
+  Run with:
+    ./brisc_to_LLVM [ -a ] [ -p ] [ program.bin ] > in.ll
+    ./jit in.ll
+
+  The program file is little-endian 32-bit instructions; without one, we
+  translate the xorshift program hardcoded below.  -a puts every
+  instruction in the jump tables, for programs that compute jump targets.
+  -p translates plainly, one instruction at a time, without the idioms.
+
+  Level 0 builds everyday operations out of a few primitives, and
+  translated one by one they make poor native code.  So the translator
+  recognizes the idioms and emits the native operation instead:
+    - NAND with inversion flags is and, or, nor, andn, or not.
+    - The three-NAND xor sequences are xor.
+    - ROT by a constant is llvm.fshr, and ROT followed by an AND with the
+      matching mask (a known constant) is a shl or lshr.
+    - NOT b followed by ADD a+~b+1 is a subtract.
+    - CSWAP of rF with rE (call) to a known function is an LLVM call,
+      and CSWAP of rE with rF (return) is a ret.
+
+  Each BRISC function (the code from pc 0, and each call target) becomes
+  an LLVM function, so LLVM can inline it.  A function returns the pc to
+  run next: a call whose callee returns to the usual place continues
+  there, and anything else goes back up to jitentry, which calls the
+  function for that pc.  A constant analysis finds jump and call targets
+  computed PC-relative, like add(rE,rF,r0,k), and the shift masks.
+
+  jitentry(arg0,mem) starts at pc 0 with arg0 in r1, and returns r1 when
+  the program jumps to itself (halts), or -999 if it fails.  Memory starts
+  zeroed: code isn't copied into memory, so self-modifying code won't work.
+
+  Dr. Orion Lawlor and the CS 601 class, 2026-02 (Public Domain)
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../BRISC/brisc.h"
+
+using namespace BRISC;
+
+// What the constant analysis knows about the registers before an instruction
+struct brisc_consts {
+	bool reached=false;
+	uint16_t known=0; // bit r set if register r holds value[r]
+	word_t value[16]={0};
+
+	bool is_known(int r) const { return r==0 || (known>>r)&1; }
+	void set(int r,word_t v) { if (r==0 || r==rF) return; known|=1<<r; value[r]=v; }
+	void forget(int r) { known&=~(1<<r); }
+
+	// Merge in another path's state.  Returns true if ours changed.
+	bool merge(const brisc_consts &o) {
+		if (!o.reached) return false;
+		if (!reached) { *this=o; return true; }
+		uint16_t k = known & o.known;
+		for (int r=1;r<rF;r++)
+			if (((k>>r)&1) && value[r]!=o.value[r]) k&=~(1<<r);
+		bool changed = k!=known;
+		known=k;
+		return changed;
+	}
+};
+
+template <long memsize=0x10000>
+class BRISC_translator {
+public:
+	bool all_targets=false; // every pc goes in the jump tables
+	bool idioms=true; // recognize multi-instruction idioms
+
+	std::ostream *out = &std::cout;
+	std::ostream &emit() { return *out; }
+
+	// Translate this program into one LLVM module with a jitentry(arg0,mem)
+	void translate(const word_t *inst_,int n_inst_)
+	{
+		inst=inst_; n_inst=n_inst_;
+		analyze();
+		find_functions();
+
+		emit()<<"; BRISC program translated by brisc_to_LLVM\n";
+		emit()<<"@jitmemsize = constant i32 "<<memsize<<"\n";
+		emit()<<"declare i32 @llvm.fshr.i32(i32, i32, i32)\n\n";
+		for (size_t f=0;f<fn_entry.size();f++)
+			translate_function(f);
+		translate_entry();
+	}
+
+	/**************** Analysis *****************/
+	const word_t *inst=0;
+	int n_inst=0;
+
+	std::vector<char> is_target; // pc might be jumped to indirectly
+	std::vector<char> is_leader; // pc is reached some way besides falling in from pc-1
+	std::vector<brisc_consts> consts; // known registers before each pc
+	std::vector<long> direct; // known new rF for instructions that write it, or -1
+	std::vector<long> call_target; // known callee for calls, or -1
+	std::vector<std::vector<int> > succ; // pcs this one continues to, in its function
+
+	static bool is_call(const brisc_fields &f) { return f.op==0x0C && f.d==rF && f.a==rE; }
+	static bool is_return(const brisc_fields &f) { return f.op==0x0C && f.d==rE && f.a==rF; }
+
+	// The value of register r at pc, if the analysis knows it
+	bool known_value(const brisc_consts &s,int r,int pc,word_t &v) {
+		if (r==rF) { v=pc+1; return true; } // reads see the next pc
+		if (!s.is_known(r)) return false;
+		v = r==0 ? 0 : s.value[r];
+		return true;
+	}
+
+	// Evaluate ADD, ROT, or NAND on these operand values
+	static word_t evaluate(const brisc_fields &f,word_t a,word_t b) {
+		switch (f.op) {
+		case 0x0A: return a + b + (word_t)f.ccc;
+		case 0x0B: return BRISC_machine<memsize>::rotate_right(a, b + (word_t)f.ccc);
+		default: // 0x0D
+			return ~((a ^ (f.I?~0u:0u)) & (b ^ (f.N?~0u:0u))) ^ (f.M?~0u:0u);
+		}
+	}
+
+	// Potential indirect targets: pc 0, the return address left by every
+	//   swap or memory op on rF, and every PC-relative address computed from rF.
+	void find_targets() {
+		is_target.assign(n_inst, all_targets);
+		if (n_inst>0) is_target[0]=1;
+		for (int pc=0;pc<n_inst;pc++) {
+			brisc_fields f(inst[pc]);
+			long t=-1;
+			if ((f.op==0x0C && (f.d==rF || f.a==rF)) || (f.op==0x0E && f.d==rF))
+				t=pc+1;
+			if (f.op==0x0A && ((f.a==rF && f.b==0) || (f.a==0 && f.b==rF)))
+				t=pc+1+f.ccc;
+			if (t>=0 && t<n_inst) is_target[t]=1;
+		}
+	}
+
+	// How control gets from one pc to the next
+	enum edge_kind { falls=0, jumps=1, calls_into=2 };
+
+	// Run the instruction at pc on the state s, and pass the states after it
+	//   to flow(next pc, state, edge_kind).  Also records direct and
+	//   call_target for pc.
+	template <class flow_fn>
+	void transfer(int pc,brisc_consts s,flow_fn flow)
+	{
+		brisc_fields f(inst[pc]);
+		word_t va=0, vb=0;
+		bool ka=known_value(s,f.a,pc,va), kb=known_value(s,f.b,pc,vb);
+		direct[pc]=-1;
+		call_target[pc]=-1;
+
+		if (f.op>=0x0A && f.op<=0x0E && f.op!=0x0C && f.op!=0x0E) { // ADD, ROT, NAND
+			bool k = ka && kb;
+			word_t v = k ? evaluate(f,va,vb) : 0;
+			if (f.d==rF) { // jump
+				if (k && v<(word_t)n_inst) { direct[pc]=v; if (v!=(word_t)pc) flow(v,s,jumps); }
+				return;
+			}
+			if (k) s.set(f.d,v); else s.forget(f.d);
+			flow(pc+1,s,falls);
+		}
+		else if (f.op==0x0C) { // CSWAP
+			bool maybe = !kb, taken = kb && (int32_t)vb>=f.ccc;
+			if (maybe || !taken) flow(pc+1,s,falls);
+			if (!(maybe || taken)) return;
+
+			if (f.d!=rF && f.a!=rF) { // plain register swap
+				word_t vd=0;
+				bool kd=known_value(s,f.d,pc,vd);
+				brisc_consts t=s;
+				t.forget(f.d); t.forget(f.a);
+				if (ka) t.set(f.d,va);
+				if (kd) t.set(f.a,vd);
+				flow(pc+1,t,falls);
+				return;
+			}
+			if (f.d==rF && f.a==rF) { flow(pc+1,s,falls); return; } // no jump
+			int x = f.d==rF ? f.a : f.d; // gets the return address
+			word_t target=0;
+			bool kt=known_value(s,x,pc,target) && target<(word_t)n_inst;
+			brisc_consts t=s;
+			t.set(x,pc+1);
+			if (is_call(f)) { // callee can change anything
+				if (kt) call_target[pc]=target;
+				brisc_consts after; after.reached=true;
+				flow(pc+1,after,jumps);
+				if (kt) { brisc_consts entry; entry.reached=true; flow(target,entry,calls_into); }
+			}
+			else if (kt) { direct[pc]=target; if (target!=(word_t)pc) flow(target,t,jumps); }
+		}
+		else if (f.op==0x0E) { // MEM
+			if (f.b!=0 || f.M>2) return; // fails
+			if (f.M!=1 && f.d==rF) return; // indirect jump through memory
+			if (f.M!=1) s.forget(f.d);
+			flow(pc+1,s,falls);
+		}
+		// anything else fails
+	}
+
+	// Find the known registers at each pc, and how control flows
+	void analyze()
+	{
+		find_targets();
+		consts.assign(n_inst,brisc_consts());
+		direct.assign(n_inst,-1);
+		call_target.assign(n_inst,-1);
+		is_leader.assign(n_inst,0);
+		calls.clear();
+
+		// Targets can be reached from anywhere, so nothing is known there
+		std::vector<int> work;
+		for (int pc=0;pc<n_inst;pc++)
+			if (is_target[pc]) { consts[pc].reached=true; work.push_back(pc); }
+
+		auto flow = [&](long to,const brisc_consts &s,int) {
+			if (to<0 || to>=n_inst) return;
+			if (consts[to].merge(s)) work.push_back(to);
+		};
+		while (!work.empty()) {
+			int pc=work.back(); work.pop_back();
+			transfer(pc,consts[pc],flow);
+		}
+
+		// Now record the final control flow
+		succ.assign(n_inst,std::vector<int>());
+		for (int pc=0;pc<n_inst;pc++) {
+			if (!consts[pc].reached) continue;
+			if (is_target[pc]) is_leader[pc]=1;
+			transfer(pc,consts[pc],[&](long to,const brisc_consts &,int kind) {
+				if (to<0 || to>=n_inst) return;
+				if (kind!=falls) is_leader[to]=1;
+				if (kind==calls_into) return; // the callee isn't part of our function
+				if (std::find(succ[pc].begin(),succ[pc].end(),(int)to)==succ[pc].end())
+					succ[pc].push_back(to);
+			});
+			if (call_target[pc]>=0) calls.push_back(call_target[pc]);
+		}
+	}
+
+	/**************** Functions *****************/
+	std::vector<int> calls; // known call targets
+	std::vector<int> fn_entry; // first pc of each function
+	std::vector<std::vector<char> > fn_body; // pcs in each function
+	std::vector<int> fn_of_entry; // function with each pc as its entry, or -1
+
+	// Functions grow from pc 0, each call target, and any target left over
+	void find_functions()
+	{
+		fn_entry.clear(); fn_body.clear();
+		fn_of_entry.assign(n_inst,-1);
+		std::vector<char> covered(n_inst,0);
+		std::vector<int> seeds(1,0);
+		seeds.insert(seeds.end(),calls.begin(),calls.end());
+		for (int pc=0;pc<n_inst;pc++)
+			if (is_target[pc]) seeds.push_back(pc);
+
+		for (size_t s=0;s<seeds.size();s++) {
+			int seed=seeds[s];
+			if (seed<0 || seed>=n_inst || fn_of_entry[seed]!=-1) continue;
+			if (s>calls.size() && covered[seed]) continue; // leftover target already in a function
+			int fn=fn_entry.size();
+			fn_entry.push_back(seed);
+			fn_of_entry[seed]=fn;
+			fn_body.push_back(std::vector<char>(n_inst,0));
+			std::vector<char> &body=fn_body.back();
+			std::vector<int> stack(1,seed);
+			while (!stack.empty()) {
+				int pc=stack.back(); stack.pop_back();
+				if (body[pc]) continue;
+				body[pc]=1; covered[pc]=1;
+				for (int next : succ[pc]) stack.push_back(next);
+			}
+		}
+	}
+
+	// Function that jitentry calls to run pc, or -1 if none
+	int fn_for(int pc) {
+		if (fn_of_entry[pc]!=-1) return fn_of_entry[pc];
+		for (size_t f=0;f<fn_entry.size();f++)
+			if (fn_body[f][pc]) return f;
+		return -1;
+	}
+
+	/**************** Emitting LLVM IR *****************/
+	int cur_fn=0;
+	int temps=0; // SSA values so far in this function
+
+	static std::string hex(unsigned long v,const char *format="%03lx") {
+		char buf[32]; snprintf(buf,sizeof(buf),format,v);
+		return buf;
+	}
+	static std::string hex_pc(int pc) { return hex(pc); }
+	std::string label(int pc) { return "L"+hex_pc(pc); }
+	std::string fn_name(int fn) { return "@brisc"+hex_pc(fn_entry[fn]); }
+
+	// Emit this instruction computing a new value, and return its name
+	std::string value(const std::string &rhs) {
+		std::string name="%v"+std::to_string(temps++);
+		emit()<<"  "+name+" = "+rhs+"\n";
+		return name;
+	}
+
+	// Current value of register r, in the instruction at pc
+	std::string get(int r,int pc) {
+		if (r==0) return "0";
+		if (r==rF) return std::to_string(pc+1);
+		return value("load i32, i32 * %r"+std::string(1,"0123456789ABCDEF"[r])+"ptr, align 4");
+	}
+
+	// Write v to register r (not rF)
+	void put(int r,const std::string &v) {
+		if (r==0) return; // writes to r0 are ignored
+		emit()<<"  store i32 "+v+", i32 * %r"+std::string(1,"0123456789ABCDEF"[r])+"ptr, align 4\n";
+	}
+
+	// Jump to pc to, or to the value v if to is -1
+	void jump(int pc,long to,const std::string &v) {
+		if (to==pc) emit()<<"  ret i32 -1 ; jumped to itself: halt\n";
+		else if (to>=0 && to<n_inst && fn_body[cur_fn][to]) emit()<<"  br label %"+label(to)+"\n";
+		else {
+			emit()<<"  store i32 "+(to>=0 ? std::to_string(to) : v)+", i32 * %target, align 4\n";
+			emit()<<"  br label %indirect\n";
+		}
+	}
+
+	// Continue at pc+1, if we can
+	void next(int pc) {
+		if (pc+1<n_inst) jump(pc,pc+1,"");
+		else emit()<<"  br label %fail ; off the end of the program\n";
+	}
+
+	// NAND with inversion flags, as the simplest LLVM operation
+	std::string nand(const brisc_fields &f,const std::string &a,const std::string &b) {
+		int flags = (f.M?4:0) | (f.I?2:0) | (f.N?1:0);
+		if (f.b==0) { // b is 0, so N decides: ~(a' & ~0) is ~a', and ~(a' & 0) is ~0
+			if (!f.N) return f.M ? "0" : "-1";
+			return (f.I ^ f.M) ? a : value("xor i32 "+a+", -1"); // copy or not
+		}
+		switch (flags) {
+		case 4: return value("and i32 "+a+", "+b); // M: and
+		case 3: return value("or i32 "+a+", "+b); // IN: or
+		case 7: return value("xor i32 "+value("or i32 "+a+", "+b)+", -1"); // MIN: nor
+		case 0: return value("xor i32 "+value("and i32 "+a+", "+b)+", -1"); // nand
+		case 5: return value("and i32 "+a+", "+value("xor i32 "+b+", -1")); // MN: a & ~b
+		case 6: return value("and i32 "+value("xor i32 "+a+", -1")+", "+b); // MI: ~a & b
+		case 1: return value("or i32 "+value("xor i32 "+a+", -1")+", "+b); // N: ~a | b
+		default: return value("or i32 "+a+", "+value("xor i32 "+b+", -1")); // I: a | ~b
+		}
+	}
+
+	// Rotate a right by this amount
+	std::string rotate(const std::string &a,const std::string &amount) {
+		return value("call i32 @llvm.fshr.i32(i32 "+a+", i32 "+a+", i32 "+amount+")");
+	}
+
+	// Can an idiom continue into pc?  Only by falling in, in this function.
+	bool idiom_next(int pc) {
+		return idioms && pc<n_inst && fn_body[cur_fn][pc] && !is_leader[pc];
+	}
+
+	// Emit a multi-instruction idiom starting at pc, and return how many
+	//   instructions it covered, or 0 if there isn't one here.
+	int emit_idiom(int pc)
+	{
+		if (!idiom_next(pc+1)) return 0;
+		brisc_fields f0(inst[pc]), f1(inst[pc+1]);
+		auto ordinary = [](const brisc_fields &f) { return f.d!=0 && f.d!=rF && f.a!=rF && f.b!=rF; };
+		if (!ordinary(f0) || !ordinary(f1)) return 0;
+		int flags0 = f0.ccc&0xFFF, flags1 = f1.ccc&0xFFF;
+
+		// xor: t1 = a&~b, t2 = ~a&b, d = t1|t2;  or t1 = a|b, t2 = nand(a,b), d = t1&t2
+		if (idiom_next(pc+2) && f0.op==0x0D && f1.op==0x0D) {
+			brisc_fields f2(inst[pc+2]);
+			int flags2 = f2.ccc&0xFFF;
+			bool same_ab = f0.a==f1.a && f0.b==f1.b;
+			bool pair = (flags0==0x101 && flags1==0x110) || (flags0==0x110 && flags1==0x101);
+			bool pair2 = (flags0==0x011 && flags1==0x000) || (flags0==0x000 && flags1==0x011);
+			bool uses = (f2.a==f0.d && f2.b==f1.d) || (f2.a==f1.d && f2.b==f0.d);
+			bool safe = f0.d!=f0.a && f0.d!=f0.b && f1.d!=f0.a && f1.d!=f0.b && f0.d!=f1.d;
+			if (ordinary(f2) && f2.op==0x0D && same_ab && uses && safe &&
+				((pair && flags2==0x011) || (pair2 && flags2==0x100)))
+			{
+				emit()<<"  ; xor idiom\n";
+				std::string a=get(f0.a,pc), b=get(f0.b,pc);
+				put(f0.d,nand(f0,a,b));
+				put(f1.d,nand(f1,a,b));
+				put(f2.d,value("xor i32 "+a+", "+b));
+				return 3;
+			}
+		}
+
+		// shift: ROT d,a,0,k then AND e,d,m with mask m a known constant
+		if (f0.op==0x0B && f0.b==0 && f1.op==0x0D && flags1==0x100) {
+			int m = f1.a==f0.d ? f1.b : f1.b==f0.d ? f1.a : -1;
+			word_t mask=0;
+			if (m>0 && m!=(int)f0.d && known_value(consts[pc+1],m,pc+1,mask)) {
+				int k = f0.ccc&31; // rotate right by k
+				std::string op="";
+				if (k>0 && mask==(~0u>>k)) op="lshr i32 %s, "+std::to_string(k);
+				if (k>0 && mask==(~0u<<(32-k))) op="shl i32 %s, "+std::to_string(32-k);
+				if (op!="") {
+					emit()<<"  ; shift idiom\n";
+					std::string a=get(f0.a,pc);
+					put(f0.d,rotate(a,std::to_string(k)));
+					op.replace(op.find("%s"),2,a);
+					put(f1.d,value(op));
+					return 2;
+				}
+			}
+		}
+
+		// subtract: t = ~b, then d = a + t + c, which is a - b + (c-1)
+		if (f0.op==0x0D && f0.b==0 && flags0==0x001 && f1.op==0x0A &&
+			(f1.a==f0.d || f1.b==f0.d) && f1.a!=f1.b)
+		{
+			int a_reg = f1.a==f0.d ? f1.b : f1.a;
+			if (a_reg!=(int)f0.d) {
+				emit()<<"  ; subtract idiom\n";
+				std::string b=get(f0.a,pc), a=get(a_reg,pc);
+				put(f0.d,value("xor i32 "+b+", -1"));
+				put(f1.d,value("add i32 "+value("sub i32 "+a+", "+b)+", "+std::to_string(f1.ccc-1)));
+				return 2;
+			}
+		}
+		return 0;
+	}
+
+	// Emit the instruction at pc
+	void emit_inst(int pc)
+	{
+		brisc_fields f(inst[pc]);
+		std::string id=hex_pc(pc);
+		switch (f.op) {
+		case 0x0A: { // ADD
+			std::string v;
+			if (f.b==0 && f.ccc==0) v=get(f.a,pc); // copy
+			else if (f.a==0 && f.b==0) v=std::to_string(f.ccc); // set
+			else {
+				v=get(f.a,pc);
+				if (f.b!=0) v=value("add i32 "+v+", "+get(f.b,pc));
+				if (f.ccc!=0) v=value("add i32 "+v+", "+std::to_string(f.ccc));
+			}
+			if (f.d==rF) return jump(pc,direct[pc],v);
+			put(f.d,v);
+			break;
+		}
+		case 0x0B: { // ROT
+			std::string a=get(f.a,pc), amount=std::to_string(f.ccc&31);
+			if (f.b!=0) amount=value("add i32 "+get(f.b,pc)+", "+std::to_string(f.ccc));
+			std::string v = (f.b==0 && (f.ccc&31)==0) ? a : rotate(a,amount);
+			if (f.d==rF) return jump(pc,direct[pc],v);
+			put(f.d,v);
+			break;
+		}
+		case 0x0D: { // NAND
+			std::string v=nand(f,get(f.a,pc),get(f.b,pc));
+			if (f.d==rF) return jump(pc,direct[pc],v);
+			put(f.d,v);
+			break;
+		}
+		case 0x0C: { // CSWAP
+			if (f.b!=0 || f.ccc>0) { // might not swap
+				word_t vb=0;
+				if (known_value(consts[pc],f.b,pc,vb)) { // analysis knows which way
+					if ((int32_t)vb<f.ccc) return next(pc); // never swaps
+				}
+				else {
+					std::string c=value("icmp sge i32 "+get(f.b,pc)+", "+std::to_string(f.ccc));
+					emit()<<"  br i1 "+c+", label %S"+id+", label %N"+id+"\n";
+					emit()<<"N"+id+":\n";
+					next(pc);
+					emit()<<"S"+id+":\n";
+				}
+			}
+			if (f.d!=rF && f.a!=rF) {
+				std::string d=get(f.d,pc), a=get(f.a,pc);
+				put(f.d,a); put(f.a,d);
+				break;
+			}
+			if (f.d==rF && f.a==rF) break;
+			int x = f.d==rF ? f.a : f.d;
+			std::string target=get(x,pc);
+			put(x,std::to_string(pc+1)); // the return address
+			if (call_target[pc]>=0) {
+				int callee=fn_of_entry[call_target[pc]];
+				std::string n=value("call i32 "+fn_name(callee)+"(i32 * %regs, i32 * %mem, i32 "
+					+std::to_string(call_target[pc])+")");
+				std::string ok=value("icmp eq i32 "+n+", "+std::to_string(pc+1));
+				emit()<<"  br i1 "+ok+", label %"+(pc+1<n_inst ? label(pc+1) : std::string("fail"))
+					+", label %R"+id+"\n";
+				emit()<<"R"+id+": ; returned somewhere else: let jitentry find it\n";
+				emit()<<"  ret i32 "+n+"\n";
+			}
+			else if (is_return(f) && direct[pc]<0) emit()<<"  ret i32 "+target+"\n";
+			else jump(pc,direct[pc],target);
+			return;
+		}
+		case 0x0E: { // MEM
+			if (f.b!=0 || f.M>2) { emit()<<"  br label %fail ; bad MEM\n"; return; }
+			std::string addr=value("add i32 "+get(f.a,pc)+", "+std::to_string(f.IN));
+			std::string ok=value("icmp ult i32 "+addr+", "+std::to_string(memsize));
+			emit()<<"  br i1 "+ok+", label %A"+id+", label %fail\n";
+			emit()<<"A"+id+":\n";
+			std::string p=value("getelementptr i32, i32 * %mem, i32 "+addr);
+			std::string old="";
+			if (f.M!=1) old=value("load i32, i32 * "+p+", align 4");
+			if (f.M!=0) emit()<<"  store i32 "+get(f.d,pc)+", i32 * "+p+", align 4\n";
+			if (f.M!=1) {
+				if (f.d==rF) return jump(pc,-1,old);
+				put(f.d,old);
+			}
+			break;
+		}
+		default:
+			emit()<<"  br label %fail ; not a level 0 opcode\n";
+			return;
+		}
+		next(pc);
+	}
+
+	// Emit function fn: it starts at the pc it's given
+	void translate_function(int fn)
+	{
+		cur_fn=fn; temps=0;
+		const std::vector<char> &body=fn_body[fn];
+		emit()<<"define internal i32 "+fn_name(fn)+"(i32 * noalias %regs, i32 * noalias %mem, i32 %pc) {\n";
+		emit()<<"  %target = alloca i32, align 4\n";
+		for (int r=1;r<rF;r++)
+			emit()<<"  %r"<<"0123456789ABCDEF"[r]<<"ptr = getelementptr i32, i32 * %regs, i32 "<<r<<"\n";
+		emit()<<"  store i32 %pc, i32 * %target, align 4\n";
+		emit()<<"  br label %indirect\n\n";
+
+		for (int pc=0;pc<n_inst;pc++) {
+			if (!body[pc]) continue;
+			emit()<<label(pc)+": ; "+hex(inst[pc],"%08lx")+"\n";
+			int len=emit_idiom(pc);
+			if (len==0) emit_inst(pc);
+			else { next(pc+len-1); pc+=len-1; }
+		}
+
+		emit()<<"\nindirect: ; jump to the pc in %target\n";
+		emit()<<"  %t = load i32, i32 * %target, align 4\n";
+		emit()<<"  switch i32 %t, label %leave [ ";
+		for (int pc=0;pc<n_inst;pc++)
+			if (body[pc] && (is_target[pc] || pc==fn_entry[fn]))
+				emit()<<" i32 "<<pc<<", label %"<<label(pc)<<" ";
+		emit()<<" ]\n";
+		emit()<<"leave: ; not ours: let the caller find it\n";
+		emit()<<"  ret i32 %t\n";
+		emit()<<"fail: ; bad instruction or memory address\n";
+		emit()<<"  ret i32 -2\n";
+		emit()<<"}\n\n";
+	}
+
+	// Emit jitentry, which calls the function for each pc until the program halts
+	void translate_entry()
+	{
+		emit()<<"define i32 @jitentry(i32 %arg0, i32 * %mem) {\n";
+		emit()<<"  %regs = alloca i32, i32 16, align 4\n";
+		for (int r=0;r<=rF;r++) {
+			emit()<<"  %r"<<"0123456789ABCDEF"[r]<<"ptr = getelementptr i32, i32 * %regs, i32 "<<r<<"\n";
+			emit()<<"  store i32 "<<(r==1 ? "%arg0" : "0")<<", i32 * %r"<<"0123456789ABCDEF"[r]<<"ptr, align 4\n";
+		}
+		emit()<<"  br label %dispatch\n\n";
+		emit()<<"dispatch: ; call the function for the pc in rF\n";
+		emit()<<"  %pc = load i32, i32 * %rFptr, align 4\n";
+		emit()<<"  switch i32 %pc, label %unknown [  i32 -1, label %done ";
+		for (int pc=0;pc<n_inst;pc++) {
+			int fn = (is_target[pc] || fn_of_entry[pc]!=-1) ? fn_for(pc) : -1;
+			if (fn!=-1) emit()<<" i32 "<<pc<<", label %call"<<fn<<" ";
+		}
+		emit()<<" ]\n";
+		for (size_t f=0;f<fn_entry.size();f++) {
+			emit()<<"call"<<f<<":\n";
+			emit()<<"  %n"<<f<<" = call i32 "+fn_name(f)+"(i32 * %regs, i32 * %mem, i32 %pc)\n";
+			emit()<<"  store i32 %n"<<f<<", i32 * %rFptr, align 4\n";
+			emit()<<"  br label %dispatch\n";
+		}
+		emit()<<"done: ; halted: return r1\n";
+		emit()<<"  %result = load i32, i32 * %r1ptr, align 4\n";
+		emit()<<"  ret i32 %result\n";
+		emit()<<"unknown: ; failed, or jumped to a pc we didn't translate\n";
+		emit()<<"  ret i32 -999\n";
+		emit()<<"}\n";
+	}
+};
+
+
+// xorshift32, r1 times, starting from 1: returns the last value
+std::vector<word_t> xorshift_program()
+{
+	std::vector<word_t> xorshift = {
+		set(r3,1), rot(r3,r3,0,-13), dec(r3), not_(r3,r3), // r3 = ~0<<13
+		rot(r4,r2,0,-13), nand(r4,r4,r3,0x100), // r4 = x<<13
+		nand(r5,r2,r4,0x101), nand(r6,r2,r4,0x110), nand(r2,r5,r6,0x011), // x ^= r4
+		set(r3,1), rot(r3,r3,0,-15), dec(r3), // r3 = ~0u>>17
+		rot(r4,r2,0,17), nand(r4,r4,r3,0x100), // r4 = x>>17
+		nand(r5,r2,r4,0x101), nand(r6,r2,r4,0x110), nand(r2,r5,r6,0x011),
+		set(r3,-32), // r3 = ~0<<5
+		rot(r4,r2,0,-5), nand(r4,r4,r3,0x100), // r4 = x<<5
+		nand(r5,r2,r4,0x101), nand(r6,r2,r4,0x110), nand(r2,r5,r6,0x011),
+		ret()
+	};
+	std::vector<word_t> program = {
+		set(r2,1), // 0: x = 1
+		add(rE,rF,0,7), // 1: rE = xorshift, at 9 (PC-relative)
+		callE(),
+		dec(r1),
+		add(r9,rF,0,-4), // r9 = 1, the loop start
+		swapcond(rF,r9,r1,1), // keep looping while r1 >= 1
+		mov(r1,r2), // return x in r1
+		halt(),
+		halt(), // 8: padding
+	};
+	program.insert(program.end(),xorshift.begin(),xorshift.end());
+	return program;
+}
+
+int main(int argc,char *argv[])
+{
+	std::vector<word_t> program = xorshift_program();
+
+	BRISC_translator<0x10000> translator;
+	for (int i=1;i<argc;i++) {
+		std::string arg=argv[i];
+		if (arg=="-a") translator.all_targets=true; // every pc in the jump tables
+		else if (arg=="-p") translator.idioms=false; // one instruction at a time
+		else program = read_brisc_program(argv[i]);
+	}
+	translator.translate(program.data(), program.size());
+	return 0;
+}
@@ -0,0 +1,1731 @@
+/*
+Implementation of ExampleJIT, a Just-In-Time (JIT) compiler using LLVM.
+The driver program is in main.cpp.
+
+This started as a single-file version collected from the files at:
+     https://github.com/vaivaswatha/lljit
+
+Dr. Orion Lawlor heavily modified this 2024-02-21 by:
+   - Simplify by removing most llvm::Expected, to use inline error handling.
+   - Add raw machine code dump to check disassembly
+   - Add optimizer passes following this obsolete gist:
+        https://gist.github.com/5pilow/c7b6d3b21cc93eadd1eb298d2d86c2b6
+
+ * Copyright (C) 2020 Vaivaswatha N
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/PassTimingInfo.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/IPO/Internalize.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Config/llvm-config.h"
+
+
+#include "example_jit.h"
+#include "runtime.h"
+
+
+
+using namespace llvm;
+
+// Error handling strategy
+ExitOnError ExitOnErr;
+
+
+// Seconds since some arbitrary start point
+static double timeNow(void) {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Add the time since Start to this phase
+void ExampleJIT::addTime(double PhaseTimes::*Phase, double Start)
+{
+    double T = timeNow()-Start;
+    std::lock_guard<std::mutex> Lock(TimesLock);
+    Times.*Phase += T;
+}
+
+// Return the total time spent in each phase so far
+ExampleJIT::PhaseTimes ExampleJIT::getPhaseTimes()
+{
+    std::lock_guard<std::mutex> Lock(TimesLock);
+    return Times;
+}
+
+// Keeps compiled object files in a directory, one file per module.
+//   ExampleJIT names each module after its cache key, which is a hash
+//   of everything that affects the generated code.
+class ExampleObjectCache : public ObjectCache {
+public:
+    std::string Dir; // empty if we're not caching
+    bool enabled() const { return !Dir.empty(); }
+
+    // Return the cached object file for this key, or null if there isn't one
+    std::unique_ptr<MemoryBuffer> getObject(StringRef Key) {
+        auto Obj = MemoryBuffer::getFile(path(Key));
+        if (!Obj) return nullptr;
+        return std::move(*Obj);
+    }
+
+    // Called by the compiler before doing codegen on a module
+    std::unique_ptr<MemoryBuffer> getObject(const Module *M) override {
+        if (!enabled() || !isKey(M->getModuleIdentifier())) return nullptr;
+        return getObject(M->getModuleIdentifier());
+    }
+
+    // Called by the compiler after doing codegen on a module
+    void notifyObjectCompiled(const Module *M, MemoryBufferRef Obj) override {
+        StringRef Key = M->getModuleIdentifier();
+        if (!enabled() || !isKey(Key)) return;
+
+        // Write to a temporary file and rename it into place, so a
+        //  concurrent run never sees a partially written object.
+        std::string Tmp = path(Key)+".tmp"+std::to_string(sys::Process::getProcessId());
+        std::error_code EC;
+        {
+            raw_fd_ostream OS(Tmp, EC, sys::fs::OF_None);
+            if (EC) return; // not fatal, we just don't cache this one
+            OS << Obj.getBuffer();
+        }
+        if (sys::fs::rename(Tmp, path(Key)))
+            sys::fs::remove(Tmp);
+    }
+
+    static bool isKey(StringRef Name) { return Name.startswith("cache-"); }
+private:
+    std::string path(StringRef Key) { return Dir+"/"+Key.str()+".o"; }
+};
+
+
+// Map function names to addresses:
+struct FunctionsMap {
+    const char *FName;
+    const void *FAddr;
+};
+const static FunctionsMap CallableFuncs[] = {
+    {"printf", (void *)printf},
+    {"puts", (void *)puts}, //< optimizer will swap printf call to puts
+    {"malloc", (void *)malloc},
+    {"exit", (void *)exit},
+    {"print_long", (void *)print_long}, //<- can also call local functions
+    {"print_hex", (void *)print_hex}, //<- can also call local functions
+    {"jit_min", (void *)jit_min}, //<- runtime.cpp, usually inlined from runtime.bc
+    {"jit_max", (void *)jit_max},
+    {"jit_abs", (void *)jit_abs},
+    {"jit_clamp", (void *)jit_clamp},
+    {"jit_hash", (void *)jit_hash},
+    {"memcpy", (void *)memcpy}, //<- optimizer can turn loops into these
+    {"memmove", (void *)memmove},
+    {"memset", (void *)memset},
+};
+
+// Add functions in the table above that the JIT'ed code can access.
+Error ExampleJIT::addCallableFunctions(void) {
+    const DataLayout &DL = JIT->getDataLayout();
+    orc::SymbolMap syms;
+    orc::MangleAndInterner Mangle(JIT->getExecutionSession(), DL);
+    // Register every symbol that can be accessed from the JIT'ed code.
+    for (auto fa : CallableFuncs) {
+        syms[Mangle(fa.FName)] = 
+#if LLVM_VERSION_MAJOR >= 17  /* compiles, but not fully working yet */
+            orc::ExecutorSymbolDef(
+                orc::ExecutorAddr::fromPtr(fa.FAddr), JITSymbolFlags()
+            );
+#else
+            JITEvaluatedSymbol(
+                 pointerToJITTargetAddress(fa.FAddr), JITSymbolFlags()
+            );
+#endif
+    }
+
+    return JIT->getMainJITDylib().define(absoluteSymbols(syms));
+}
+
+// Parse LLVM IR assembly text or bitcode into a Module, or print the
+//  errors and return null.  Bitcode is read lazily: we only read the
+//  module's globals and function types here, and materialize reads
+//  the function bodies later, in addModule.
+std::unique_ptr<llvm::Module> ExampleJIT::addIR(MemoryBufferRef Source,
+    llvm::LLVMContext &Ctx)
+{
+    double Start = timeNow();
+    if (isBitcode((const unsigned char *)Source.getBufferStart(),
+                  (const unsigned char *)Source.getBufferEnd())) {
+        // The Module reads from its buffer until it's materialized
+        auto M = getOwningLazyBitcodeModule(MemoryBuffer::getMemBufferCopy(
+            Source.getBuffer(), Source.getBufferIdentifier()), Ctx);
+        addTime(&PhaseTimes::Parse, Start);
+        if (!M) {
+            logAllUnhandledErrors(M.takeError(), errs(),
+                "lljit: "+Source.getBufferIdentifier()+": ");
+            return nullptr;
+        }
+        return std::move(*M);
+    }
+
+    // The text parser reads up to a null after the text, which a view
+    //  (like a slice of a bigger buffer) might not have
+    auto Text = MemoryBuffer::getMemBufferCopy(Source.getBuffer(), Source.getBufferIdentifier());
+    SMDiagnostic Smd;
+    auto M = parseIR(*Text, Smd, Ctx);
+    addTime(&PhaseTimes::Parse, Start);
+    if (!M) { // Print compile errors
+        std::lock_guard<std::mutex> Lock(PrintLock);
+        Smd.print("lljit", errs());
+    }
+    return M;
+}
+
+// Read in the function bodies of this lazily loaded bitcode Module
+Error ExampleJIT::materialize(llvm::Module &M)
+{
+    if (!M.getMaterializer()) return Error::success(); // already all here
+    double Start = timeNow();
+    Error Err = M.materializeAll();
+    addTime(&PhaseTimes::Parse, Start);
+    return Err;
+}
+
+// Print this LLVM IR module's functions and blocks
+void printModule(const llvm::Module &M,const char *where,raw_ostream &OS)
+{
+    for (const llvm::Function &F : M)
+    {
+        OS<<"define "<<F.getName()<<"() { ;  ("<<where<<")\n";
+        for (const llvm::BasicBlock &B : F)
+        {
+            if (B.getName()!="") OS<<"\n  "<<B.getName()<<": ";
+            for (const llvm::BasicBlock *pre : predecessors(&B))
+                OS<<"    ; Predecessor: %"<<pre->getName()<<"\n";
+            
+            for (const llvm::Instruction &I : B)
+                OS<<"    "<<I<<"\n";
+        }
+        OS<<"}\n\n";
+    }
+}
+
+// Module flag holding the optimization level name, like "O2"
+static const char OptLevelFlag[] = "exampleJIT.optlevel";
+
+// Return the optimization level name stored in this module
+static StringRef moduleOptLevel(const Module &M)
+{
+    if (auto *Name = dyn_cast_or_null<MDString>(M.getModuleFlag(OptLevelFlag)))
+        return Name->getString();
+    return "O2";
+}
+
+// Look up the IR optimization level with this name.
+static bool findOptLevel(StringRef Name, OptimizationLevel &Level)
+{
+    if (Name=="O0") Level = OptimizationLevel::O0;
+    else if (Name=="O1") Level = OptimizationLevel::O1;
+    else if (Name=="O2") Level = OptimizationLevel::O2;
+    else if (Name=="O3") Level = OptimizationLevel::O3;
+    else if (Name=="Os") Level = OptimizationLevel::Os;
+    else if (Name=="Oz") Level = OptimizationLevel::Oz;
+    else return false;
+    return true;
+}
+
+// Codegen optimization level to go with this IR optimization level name
+static CodeGenOpt::Level codeGenLevel(StringRef Name)
+{
+    if (Name=="O0") return CodeGenOpt::None; // fast instruction selection
+    if (Name=="O1") return CodeGenOpt::Less;
+    if (Name=="O3") return CodeGenOpt::Aggressive;
+    return CodeGenOpt::Default;
+}
+
+// Compiles each module to an object file with its own TargetMachine,
+//   for ExampleJIT's target CPU, at the codegen level that matches the
+//   module's optimization level.  Checks the object cache first.
+//   Safe to call from several threads.
+class ExampleCompiler : public orc::IRCompileLayer::IRCompiler {
+public:
+    ExampleCompiler(orc::JITTargetMachineBuilder JTMB, ExampleJIT &J_)
+        :IRCompiler(orc::irManglingOptionsFromTargetOptions(JTMB.getOptions())),
+         J(J_) {}
+
+    Expected<std::unique_ptr<MemoryBuffer>> operator()(Module &M) override {
+        double Start = timeNow();
+        orc::JITTargetMachineBuilder Builder = *J.JTMB;
+        Builder.setCodeGenOptLevel(codeGenLevel(moduleOptLevel(M)));
+        auto TM = Builder.createTargetMachine();
+        if (!TM) return TM.takeError();
+        orc::SimpleCompiler Compiler(**TM, J.Cache.get());
+        auto Obj = Compiler(M);
+        J.addTime(&ExampleJIT::PhaseTimes::Codegen, Start);
+        return Obj;
+    }
+private:
+    ExampleJIT &J;
+};
+
+// Hands out JIT memory, in whole pages, from a few big slabs.  Mapping
+//  a 16 MB slab once replaces an mmap and munmap for every section of
+//  every module.  Code fills each slab from the bottom and data from the
+//  top, so the code of many small modules is packed together, which is
+//  easier on the iTLB (and all within reach of a 32-bit displacement).
+//  Removed modules give their pages back (and their memory back to the
+//  OS), for the next modules to reuse.
+class ExampleSlabPool {
+public:
+    enum : size_t { SlabBytes = 16<<20 };
+    bool Closing=false; // set when we're about to unmap everything
+
+    ~ExampleSlabPool() {
+        for (sys::MemoryBlock &Slab : Slabs)
+            sys::Memory::releaseMappedMemory(Slab);
+    }
+
+    // Return NumBytes (rounded up to pages) of read-write memory
+    sys::MemoryBlock allocate(size_t NumBytes, bool Code, std::error_code &EC) {
+        size_t Page = sys::Process::getPageSizeEstimate();
+        NumBytes = (NumBytes + Page-1) / Page * Page;
+        std::lock_guard<std::mutex> L(Lock);
+
+        // Reuse the first freed run that's big enough
+        for (auto I = Free.begin(); I != Free.end(); ++I)
+            if (I->second >= NumBytes) {
+                char *Base = I->first;
+                size_t Left = I->second - NumBytes;
+                Free.erase(I);
+                if (Left) Free[Base+NumBytes] = Left;
+                return sys::MemoryBlock(Base, NumBytes); // release made it read-write
+            }
+
+        if ((size_t)(End - Next) < NumBytes) { // start a new slab, next to the last one
+            size_t Bytes = std::max<size_t>(SlabBytes, NumBytes);
+            sys::MemoryBlock Slab = sys::Memory::allocateMappedMemory(Bytes,
+                Slabs.empty() ? nullptr : &Slabs.back(),
+                sys::Memory::MF_READ | sys::Memory::MF_WRITE, EC);
+            if (EC) return sys::MemoryBlock();
+            if (Next < End) Free[Next] = End - Next;
+            Slabs.push_back(Slab);
+            Next = (char *)Slab.base();
+            End = Next + Slab.allocatedSize();
+        }
+        // Fresh pages are already read-write
+        if (Code) {
+            sys::MemoryBlock B(Next, NumBytes);
+            Next += NumBytes;
+            return B;
+        }
+        End -= NumBytes;
+        return sys::MemoryBlock(End, NumBytes);
+    }
+
+    // Take back this block from allocate, for reuse
+    void release(sys::MemoryBlock &B) {
+        char *Base = (char *)B.base();
+        size_t Bytes = B.allocatedSize();
+        if (Closing) return;
+        // New zero pages, read-write again, and the OS can have the old ones
+        mmap(Base, Bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        std::lock_guard<std::mutex> L(Lock);
+        auto After = Free.find(Base + Bytes);
+        if (After != Free.end()) { // merge with the free run after it
+            Bytes += After->second;
+            Free.erase(After);
+        }
+        auto Before = Free.lower_bound(Base);
+        if (Before != Free.begin() && (--Before, Before->first + Before->second == Base))
+            Before->second += Bytes; // merge with the run before it
+        else
+            Free[Base] = Bytes;
+    }
+
+private:
+    std::mutex Lock; // protects everything below
+    std::vector<sys::MemoryBlock> Slabs; // in the order we mapped them
+    char *Next=0, *End=0; // the part of the newest slab nobody has used yet
+    std::map<char *, size_t> Free; // released runs of pages, by address
+};
+
+// Maps memory from the slab pool for one module's sections, and counts
+//  the bytes mapped
+class ExampleMemoryMapper : public SectionMemoryManager::MemoryMapper {
+public:
+    std::atomic<size_t> CodeBytes{0}, DataBytes{0}; // mapped right now
+
+    explicit ExampleMemoryMapper(ExampleSlabPool &Pool_) :Pool(Pool_) {}
+
+    sys::MemoryBlock allocateMappedMemory(SectionMemoryManager::AllocationPurpose Purpose,
+        size_t NumBytes, const sys::MemoryBlock *const NearBlock, unsigned Flags,
+        std::error_code &EC) override {
+        bool Code = Purpose == SectionMemoryManager::AllocationPurpose::Code;
+        sys::MemoryBlock B = Pool.allocate(NumBytes, Code, EC);
+        if (!EC && Flags != (sys::Memory::MF_READ | sys::Memory::MF_WRITE))
+            EC = sys::Memory::protectMappedMemory(B, Flags);
+        if (EC) return sys::MemoryBlock();
+        if (B.base()) {
+            (Code ? CodeBytes : DataBytes) += B.allocatedSize();
+            std::lock_guard<std::mutex> L(Lock);
+            IsCode[B.base()] = Code;
+        }
+        return B;
+    }
+    std::error_code protectMappedMemory(const sys::MemoryBlock &Block,
+        unsigned Flags) override {
+        return sys::Memory::protectMappedMemory(Block, Flags);
+    }
+    std::error_code releaseMappedMemory(sys::MemoryBlock &M) override {
+        {
+            std::lock_guard<std::mutex> L(Lock);
+            auto I = IsCode.find(M.base());
+            if (I != IsCode.end()) {
+                (I->second ? CodeBytes : DataBytes) -= M.allocatedSize();
+                IsCode.erase(I);
+            }
+        }
+        Pool.release(M);
+        M = sys::MemoryBlock();
+        return std::error_code();
+    }
+private:
+    ExampleSlabPool &Pool;
+    std::mutex Lock; // protects IsCode
+    std::map<void *, bool> IsCode; // each block we've mapped
+};
+
+// The modules added under one name share a ResourceTracker, which owns
+//  all their code and data, so we can remove them together.
+struct ExampleModule {
+    std::string Name;
+    orc::ResourceTrackerSP Code;
+    ExampleMemoryMapper Memory; // counts the memory its sections use
+    uint64_t LastUsed=0; // Clock at its last add or lookup
+
+    explicit ExampleModule(ExampleSlabPool &Pool) :Memory(Pool) {}
+};
+
+// The module whose object code is being loaded on this thread
+static thread_local std::shared_ptr<ExampleModule> EmittingModule;
+
+// Keeps a module alive until its memory manager has released its memory
+struct ExampleModuleRef {
+    std::shared_ptr<ExampleModule> Mod;
+};
+
+// Allocates each object's sections with its module's mapper, or the
+//  mapper for code outside our modules (like lazily compiled functions)
+//  (ExampleModuleRef comes first, so it's destroyed last)
+class ExampleMemoryManager : private ExampleModuleRef, public SectionMemoryManager {
+public:
+    ExampleMemoryManager(std::shared_ptr<ExampleModule> Mod_, ExampleMemoryMapper &Other)
+        :ExampleModuleRef{Mod_},
+         SectionMemoryManager(Mod_ ? &Mod_->Memory : &Other) {}
+};
+
+// Loads object files into memory and links them, timing how long it takes.
+//   If the symbols an object needs are still being compiled, the last
+//   part of linking happens later, and isn't counted.
+class ExampleLinkingLayer : public orc::RTDyldObjectLinkingLayer {
+public:
+    ExampleLinkingLayer(orc::ExecutionSession &ES, ExampleJIT &J_)
+        :RTDyldObjectLinkingLayer(ES, [&J_]() {
+            return std::make_unique<ExampleMemoryManager>(EmittingModule, *J_.OtherMemory);
+         }),
+         J(J_) {}
+
+    void emit(std::unique_ptr<orc::MaterializationResponsibility> R,
+              std::unique_ptr<MemoryBuffer> O) override {
+        double Start = timeNow();
+        EmittingModule = J.emitting(*R); // sections get allocated during emit
+        RTDyldObjectLinkingLayer::emit(std::move(R), std::move(O));
+        EmittingModule = nullptr;
+        J.addTime(&ExampleJIT::PhaseTimes::Link, Start);
+    }
+private:
+    ExampleJIT &J;
+};
+
+// Run optimization passes on this LLVM IR Module, using the standard
+//  clang-like pipeline for its optimization level.  At O1 and above
+//  this includes inlining within the module, and at O2 and above the
+//  loop and SLP vectorizers (unless setVectorize turned them off).
+//  Source: https://llvm.org/docs/NewPassManager.html
+void ExampleJIT::optimize(llvm::Module &M)
+{
+    double Start = timeNow();
+    OptimizationLevel Level;
+    if (!findOptLevel(moduleOptLevel(M), Level)) Level = OptimizationLevel::O2;
+
+    // The TargetMachine tells the passes what our CPU can do
+    std::unique_ptr<TargetMachine> TM = ExitOnErr(JTMB->createTargetMachine());
+
+    std::string Report;
+    raw_string_ostream OS(Report);
+    {
+        TimePassesHandler Timer(TimePasses); // prints to OS when destroyed
+        Timer.setOutStream(OS);
+        PassInstrumentationCallbacks PIC;
+        Timer.registerCallbacks(PIC);
+
+        LoopAnalysisManager LAM;
+        FunctionAnalysisManager FAM;
+        CGSCCAnalysisManager CGAM;
+        ModuleAnalysisManager MAM;
+        PipelineTuningOptions PTO;
+        PTO.LoopVectorization = Vectorize;
+        PTO.SLPVectorization = Vectorize;
+        PassBuilder PB(TM.get(), PTO, None, &PIC);
+        PB.registerModuleAnalyses(MAM);
+        PB.registerCGSCCAnalyses(CGAM);
+        PB.registerFunctionAnalyses(FAM);
+        PB.registerLoopAnalyses(LAM);
+        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+        ModulePassManager MPM = (Level == OptimizationLevel::O0)
+            ? PB.buildO0DefaultPipeline(Level)
+            : PB.buildPerModuleDefaultPipeline(Level);
+        MPM.run(M, MAM);
+    }
+    addTime(&PhaseTimes::Optimize, Start);
+
+    if (TimePasses) {
+        std::lock_guard<std::mutex> Lock(PrintLock);
+        errs()<<"Pass timing for "<<M.getModuleIdentifier()<<" at "<<moduleOptLevel(M)<<":\n"<<OS.str();
+    }
+}
+
+// Set up an empty JIT
+ExampleJIT::ExampleJIT(unsigned CompileThreads)
+    :OK(false)
+{
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+
+    // Generate code for the CPU we're running on, using all its features
+    //   (like AVX-512), unless setTarget changes this.
+    auto JTMB = orc::JITTargetMachineBuilder::detectHost();
+    if (!JTMB) {
+        ExitOnErr(JTMB.takeError());
+        return;
+    }
+    this->JTMB = std::make_unique<orc::JITTargetMachineBuilder>(*JTMB);
+    setTarget("host");
+
+    // Create an LLJIT instance.  Our compiler checks the object cache
+    //  before doing codegen (once setCacheDir turns it on).  Each compile
+    //  gets its own TargetMachine, so compile threads can overlap.
+    //  Our linker tells gdb about each object, so it can find JIT'd functions.
+    Cache = std::make_unique<ExampleObjectCache>();
+    Slabs = std::make_unique<ExampleSlabPool>();
+    OtherMemory = std::make_unique<ExampleMemoryMapper>(*Slabs);
+    auto J = orc::LLLazyJITBuilder()
+        .setJITTargetMachineBuilder(*JTMB)
+        .setNumCompileThreads(CompileThreads)
+        .setCompileFunctionCreator([this](orc::JITTargetMachineBuilder JTMB)
+            -> Expected<std::unique_ptr<orc::IRCompileLayer::IRCompiler>> {
+            return std::make_unique<ExampleCompiler>(std::move(JTMB), *this);
+        })
+        .setObjectLinkingLayerCreator([this](orc::ExecutionSession &ES, const Triple &TT)
+            -> Expected<std::unique_ptr<orc::ObjectLayer>> {
+            auto L = std::make_unique<ExampleLinkingLayer>(ES, *this);
+            L->registerJITEventListener(*JITEventListener::createGDBRegistrationListener());
+            Linker = L.get();
+            return L;
+        })
+        .create();
+    if (!J) {
+        ExitOnErr(std::move(J));
+        return;
+    }
+    JIT = std::move(*J);
+
+    // Modules get optimized just before codegen, on the compile threads.
+    //  For lazy modules, this is only the functions about to be called.
+    JIT->getIRTransformLayer().setTransform(
+        [this](orc::ThreadSafeModule TSM, orc::MaterializationResponsibility &R)
+            -> Expected<orc::ThreadSafeModule> {
+        TSM.withModuleDo([this](Module &M) {
+            std::string Out;
+            raw_string_ostream OS(Out);
+            if (Verbose) printModule(M,"before optimization",OS);
+            optimize(M);
+            if (Verbose) {
+                printModule(M,"after optimization",OS);
+                std::lock_guard<std::mutex> Lock(PrintLock);
+                errs()<<OS.str();
+            }
+        });
+        return TSM;
+    });
+
+    if (addCallableFunctions()) {
+        return;
+    }
+
+    OK = true;
+}
+
+// Compile this LLVM IR file
+ExampleJIT::ExampleJIT(const std::string &Filename) 
+    :ExampleJIT()
+{
+    Verbose = true;
+    if (OK) OK = addFile(Filename);
+}
+
+// Generate code for this CPU and features
+void ExampleJIT::setTarget(const std::string &CPU, const std::string &Features)
+{
+    if (CPU=="host") { // what we're running on, with all its features
+        auto Host = orc::JITTargetMachineBuilder::detectHost();
+        if (!Host) {
+            ExitOnErr(Host.takeError());
+            return;
+        }
+        JTMB->setCPU(Host->getCPU());
+        JTMB->getFeatures() = Host->getFeatures();
+    }
+    else { // just the CPU's own features
+        JTMB->setCPU(CPU);
+        JTMB->getFeatures() = SubtargetFeatures();
+    }
+
+    std::vector<std::string> Extra;
+    for (StringRef Rest = Features; !Rest.empty(); ) {
+        std::pair<StringRef, StringRef> F = Rest.split(',');
+        if (!F.first.empty()) Extra.push_back(F.first.str());
+        Rest = F.second;
+    }
+    JTMB->addFeatures(Extra);
+
+    Target = JTMB->getTargetTriple().str()+" "+JTMB->getCPU()+" "+
+        JTMB->getFeatures().getString();
+}
+
+// Tell perf about functions compiled from now on
+bool ExampleJIT::enablePerf()
+{
+    JITEventListener *Perf = JITEventListener::createPerfJITEventListener();
+    if (!Perf) return false; // LLVM was built without perf support
+    Linker->registerJITEventListener(*Perf);
+    return true;
+}
+
+// Optimize modules added after this at this level
+bool ExampleJIT::setOptLevel(const std::string &Level)
+{
+    OptimizationLevel L;
+    if (!findOptLevel(Level, L)) {
+        errs()<<"lljit: unknown optimization level "<<Level<<" (use O0, O1, O2, O3, Os, or Oz)\n";
+        return false;
+    }
+    OptLevel = Level;
+    return true;
+}
+
+// Start caching object files in this directory
+bool ExampleJIT::setCacheDir(const std::string &Dir)
+{
+    if (std::error_code EC = sys::fs::create_directories(Dir)) {
+        errs()<<"lljit: can't create cache directory "<<Dir<<": "<<EC.message()<<"\n";
+        return false;
+    }
+    Cache->Dir = Dir;
+    return true;
+}
+
+// Hash everything that affects the code we generate for this IR source
+std::string ExampleJIT::cacheKey(StringRef Source)
+{
+    SHA1 Hash;
+    Hash.update("LLVM " LLVM_VERSION_STRING "\n");
+    Hash.update(Target+"\n");
+    Hash.update("PassBuilder "+OptLevel+(Vectorize ? " vectorize" : "")+"\n");
+    for (const std::string &Name : BatchWrappers)
+        Hash.update("batch "+Name+"\n");
+    if (Runtime) Hash.update("runtime "+RuntimeHash+"\n");
+    Hash.update(Source);
+    return "cache-"+toHex(Hash.final(), true);
+}
+
+// Describe this type like ExampleJIT::typeName does
+static std::string typeName(Type *T)
+{
+    if (T->isPointerTy()) return "ptr";
+    if (T->isFloatTy()) return "float";
+    if (T->isDoubleTy()) return "double";
+    if (T->isIntegerTy()) return "i"+std::to_string(T->getIntegerBitWidth());
+    return "?";
+}
+
+// Add a function F.batch(In *in, Out *out, i64 n, args...) to F's module,
+//  which loops over the arrays storing F(in[i], args...) into out[i].
+//  The string F.batch.type says what F takes, like "i32(i32,ptr)", so
+//  callers can check their arrays match.
+static void addBatchLoop(Function &F)
+{
+    FunctionType *FT = F.getFunctionType();
+    if (FT->getNumParams()<1 || FT->getReturnType()->isVoidTy()) return;
+    LLVMContext &Ctx = F.getContext();
+    Type *InT = FT->getParamType(0), *OutT = FT->getReturnType();
+    Type *I64 = Type::getInt64Ty(Ctx);
+
+    std::vector<Type *> Params{ InT->getPointerTo(), OutT->getPointerTo(), I64 };
+    for (unsigned p=1; p<FT->getNumParams(); p++)
+        Params.push_back(FT->getParamType(p));
+    Function *B = Function::Create(
+        FunctionType::get(Type::getVoidTy(Ctx), Params, false),
+        GlobalValue::ExternalLinkage, F.getName()+".batch", F.getParent());
+    Argument *In = B->getArg(0), *Out = B->getArg(1), *N = B->getArg(2);
+
+    BasicBlock *Entry = BasicBlock::Create(Ctx, "entry", B);
+    BasicBlock *Loop = BasicBlock::Create(Ctx, "loop", B);
+    BasicBlock *Done = BasicBlock::Create(Ctx, "done", B);
+    IRBuilder<> Build(Entry);
+    Build.CreateCondBr(Build.CreateICmpEQ(N, ConstantInt::get(I64, 0)), Done, Loop);
+
+    Build.SetInsertPoint(Loop);
+    PHINode *I = Build.CreatePHI(I64, 2, "i");
+    I->addIncoming(ConstantInt::get(I64, 0), Entry);
+    std::vector<Value *> Args{ Build.CreateLoad(InT, Build.CreateGEP(InT, In, I)) };
+    for (unsigned p=3; p<B->arg_size(); p++)
+        Args.push_back(B->getArg(p));
+    Value *R = Build.CreateCall(&F, Args);
+    Build.CreateStore(R, Build.CreateGEP(OutT, Out, I));
+    Value *Next = Build.CreateAdd(I, ConstantInt::get(I64, 1), "next", true, true);
+    I->addIncoming(Next, Loop);
+    Build.CreateCondBr(Build.CreateICmpEQ(Next, N), Done, Loop);
+
+    Build.SetInsertPoint(Done);
+    Build.CreateRetVoid();
+
+    std::string Sig = typeName(OutT)+"(";
+    for (unsigned p=0; p<FT->getNumParams(); p++)
+        Sig += (p ? "," : "")+typeName(FT->getParamType(p));
+    Constant *Str = ConstantDataArray::getString(Ctx, Sig+")");
+    new GlobalVariable(*F.getParent(), Str->getType(), true,
+        GlobalValue::ExternalLinkage, Str, F.getName()+".batch.type");
+}
+
+std::string ExampleJIT::batchType(const std::string &Name)
+{
+    const char *Type = get<const char>(Name+".batch.type");
+    return Type ? Type : "";
+}
+
+// Return true if function Name's .batch loop takes this type
+bool ExampleJIT::checkBatchType(const std::string &Name, const std::string &Type)
+{
+    std::string Compiled = batchType(Name);
+    if (Compiled==Type) return true;
+    errs()<<"lljit: "<<Name<<".batch is compiled for "<<Compiled
+        <<", but called with "<<Type<<"\n";
+    return false;
+}
+
+
+/******************** Profile-guided tier-up *********************
+ A profiled module is compiled twice.  The first tier counts how often
+ each function is entered and each branch edge is taken.  Once a function
+ is hot, the second tier gets compiled from the original IR, with those
+ counts attached as entry counts and branch weights, so the optimizer
+ knows which paths matter when it lays out blocks, inlines, and unrolls.
+
+ Callers (including the module's own functions) reach each function
+ through a stub holding its current address, so we can atomically point
+ the stub at the second tier.  The module's globals are shared between
+ the tiers: the first tier defines them, and the second tier uses them.
+*/
+
+// One profiled module
+struct ExampleProfile {
+    ExampleTierUp *Tiers;
+    std::string IR; // the original IR text, to recompile from
+    std::string Tag; // makes this module's symbol names unique
+    std::vector<std::string> Functions; // the exported functions, which get stubs
+    orc::ResourceTrackerSP Code; // both tiers' code
+    std::unique_ptr<uint64_t[]> Counts; // written by the first tier's code
+    std::atomic<bool> Hot{false}; // set once we've started recompiling
+};
+
+// A place we count: a function's entry, or an edge out of a branch
+struct ProfileSite {
+    Function *F;
+    Instruction *Branch; // null for the function entry
+    unsigned Succ; // which edge of Branch
+};
+
+// List the profile sites in this module.  This only depends on the
+//  original IR, so both tiers number the sites the same way.
+static std::vector<ProfileSite> profileSites(Module &M)
+{
+    std::vector<ProfileSite> Sites;
+    for (Function &F : M) {
+        if (F.isDeclaration()) continue;
+        Sites.push_back({&F, nullptr, 0});
+        for (BasicBlock &B : F) {
+            Instruction *T = B.getTerminator();
+            BranchInst *Br = dyn_cast<BranchInst>(T);
+            if ((Br && Br->isConditional()) || isa<SwitchInst>(T))
+                for (unsigned s=0; s<T->getNumSuccessors(); s++)
+                    Sites.push_back({&F, T, s});
+        }
+    }
+    return Sites;
+}
+
+// Pointer to this host object, as an IR constant of this type
+static Constant *hostPointer(const void *Ptr, Type *T)
+{
+    Type *I64 = Type::getInt64Ty(T->getContext());
+    return ConstantExpr::getIntToPtr(ConstantInt::get(I64, (uint64_t)Ptr), T);
+}
+
+// Called by first tier code when a function gets hot
+static void exampleJIT_hot(ExampleProfile *P);
+
+// Add code to count each profile site, and call exampleJIT_hot
+//  when a function has been called HotCalls times.
+static void addCounters(Module &M, ExampleProfile &P, uint64_t HotCalls)
+{
+    std::vector<ProfileSite> Sites = profileSites(M);
+    P.Counts.reset(new uint64_t[Sites.size()]());
+
+    LLVMContext &Ctx = M.getContext();
+    Type *I64 = Type::getInt64Ty(Ctx);
+    Type *I8Ptr = Type::getInt8PtrTy(Ctx);
+    FunctionType *HotType = FunctionType::get(Type::getVoidTy(Ctx), {I8Ptr}, false);
+    for (size_t i=0; i<Sites.size(); i++) {
+        ProfileSite &S = Sites[i];
+        Constant *Counter = hostPointer(&P.Counts[i], I64->getPointerTo());
+        if (!S.Branch) { // function entry, after any allocas
+            BasicBlock::iterator Pos = S.F->getEntryBlock().getFirstInsertionPt();
+            while (isa<AllocaInst>(*Pos)) ++Pos;
+            IRBuilder<> Build(&*Pos);
+            Value *N = Build.CreateAdd(Build.CreateLoad(I64, Counter), ConstantInt::get(I64, 1));
+            Build.CreateStore(N, Counter);
+            Instruction *Then = SplitBlockAndInsertIfThen(
+                Build.CreateICmpEQ(N, ConstantInt::get(I64, HotCalls)), &*Pos, false);
+            Build.SetInsertPoint(Then);
+            Build.CreateCall(HotType, hostPointer((void *)exampleJIT_hot, HotType->getPointerTo()),
+                {hostPointer(&P, I8Ptr)});
+        }
+        else { // count on a new block along the edge
+            BasicBlock *From = S.Branch->getParent();
+            BasicBlock *To = S.Branch->getSuccessor(S.Succ);
+            BasicBlock *Edge = BasicBlock::Create(Ctx, "count", S.F, To);
+            IRBuilder<> Build(Edge);
+            Build.CreateStore(Build.CreateAdd(Build.CreateLoad(I64, Counter),
+                ConstantInt::get(I64, 1)), Counter);
+            Build.CreateBr(To);
+            S.Branch->setSuccessor(S.Succ, Edge);
+            for (PHINode &Phi : To->phis()) // (one edge at a time, if From is there twice)
+                Phi.setIncomingBlock(Phi.getBasicBlockIndex(From), Edge);
+        }
+    }
+}
+
+// Attach the counts from the first tier to this module, as function
+//  entry counts and branch weights
+static void addProfile(Module &M, const ExampleProfile &P)
+{
+    std::vector<ProfileSite> Sites = profileSites(M);
+    MDBuilder MDB(M.getContext());
+    for (size_t i=0; i<Sites.size(); ) {
+        ProfileSite &S = Sites[i];
+        if (!S.Branch) {
+            S.F->setEntryCount(Function::ProfileCount(P.Counts[i], Function::PCT_Real));
+            i++;
+            continue;
+        }
+        // Branch weights are 32 bits, so scale big counts down
+        uint64_t Max = 1;
+        unsigned N = S.Branch->getNumSuccessors();
+        for (unsigned s=0; s<N; s++) Max = std::max(Max, P.Counts[i+s]);
+        uint64_t Scale = Max/UINT32_MAX + 1;
+        std::vector<uint32_t> Weights;
+        for (unsigned s=0; s<N; s++) Weights.push_back(P.Counts[i+s]/Scale);
+        S.Branch->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(Weights));
+        i += N;
+    }
+}
+
+// Rename this module's symbols for this tier (1 or 2), so both tiers
+//  can be loaded at once, and list the exported functions in P.
+static void renameForTier(Module &M, ExampleProfile &P, int Tier)
+{
+    // Globals are shared, so give local ones a unique exported name,
+    //  and let the first tier define them
+    for (GlobalVariable &G : M.globals()) {
+        if (G.isDeclaration()) continue;
+        if (G.hasLocalLinkage()) {
+            G.setLinkage(GlobalValue::ExternalLinkage);
+            G.setVisibility(GlobalValue::HiddenVisibility);
+            G.setName(G.getName()+"."+P.Tag);
+        }
+        if (Tier==2) {
+            G.setInitializer(nullptr);
+            G.setComdat(nullptr);
+        }
+    }
+
+    // Each exported function F becomes F.tag.tierN, behind a stub named F
+    std::string Suffix = "."+P.Tag+".tier"+std::to_string(Tier);
+    std::vector<Function *> Exported;
+    for (Function &F : M)
+        if (!F.isDeclaration() && !F.hasLocalLinkage())
+            Exported.push_back(&F);
+    P.Functions.clear();
+    for (Function *F : Exported) {
+        std::string Name = F->getName().str();
+        P.Functions.push_back(Name);
+        F->setName(Name+Suffix);
+        if (Tier==1 && !F->use_empty()) { // calls go through the stub, so they switch tiers too
+            Function *Stub = Function::Create(F->getFunctionType(),
+                GlobalValue::ExternalLinkage, Name, M);
+            F->replaceAllUsesWith(Stub);
+        }
+    }
+}
+
+// The stubs and profiles for our profiled modules, and a thread that
+//  recompiles them once they get hot.
+class ExampleTierUp {
+public:
+    ExampleJIT &J;
+    std::unique_ptr<orc::LazyCallThroughManager> CallThrough;
+    std::unique_ptr<orc::IndirectStubsManager> Stubs;
+    std::atomic<int> TierUps{0};
+
+    ExampleTierUp(ExampleJIT &J_) :J(J_) {
+        const Triple &TT = J.JIT->getTargetTriple();
+        CallThrough = ExitOnErr(orc::createLocalLazyCallThroughManager(
+            TT, J.JIT->getExecutionSession(), 0));
+        Stubs = orc::createLocalIndirectStubsManagerBuilder(TT)();
+        Worker = std::thread(&ExampleTierUp::work, this);
+    }
+
+    // Keep this profile around as long as its code might run
+    ExampleProfile &add(std::unique_ptr<ExampleProfile> P) {
+        std::lock_guard<std::mutex> Lock(QueueLock);
+        P->Tiers = this;
+        P->Tag = "p"+std::to_string(Profiles.size());
+        Profiles.push_back(std::move(P));
+        return *Profiles.back();
+    }
+
+    // Recompile this module in the background
+    void hot(ExampleProfile *P) {
+        if (P->Hot.exchange(true)) return; // already on its way
+        std::lock_guard<std::mutex> Lock(QueueLock);
+        Queue.push_back(P);
+        Wake.notify_one();
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> Lock(QueueLock);
+            Stopping = true;
+            Wake.notify_one();
+        }
+        if (Worker.joinable()) Worker.join();
+    }
+
+private:
+    std::mutex QueueLock; // protects everything below
+    std::condition_variable Wake;
+    std::deque<ExampleProfile *> Queue; // hot modules to recompile
+    std::vector<std::unique_ptr<ExampleProfile>> Profiles;
+    bool Stopping=false;
+    std::thread Worker;
+
+    void work() {
+        std::unique_lock<std::mutex> Lock(QueueLock);
+        while (true) {
+            Wake.wait(Lock, [this]() { return Stopping || !Queue.empty(); });
+            if (Stopping) return;
+            ExampleProfile *P = Queue.front();
+            Queue.pop_front();
+            Lock.unlock();
+            J.tierUp(*P);
+            TierUps++;
+            Lock.lock();
+        }
+    }
+};
+
+static void exampleJIT_hot(ExampleProfile *P)
+{
+    P->Tiers->hot(P);
+}
+
+// Compile this module's first tier, with counters, behind stubs
+bool ExampleJIT::addProfiled(std::unique_ptr<llvm::Module> M,
+    std::unique_ptr<llvm::LLVMContext> Ctx, orc::ResourceTrackerSP Code)
+{
+    auto NewP = std::make_unique<ExampleProfile>();
+    NewP->Code = Code;
+    raw_string_ostream(NewP->IR) << *M;
+    ExampleProfile &P = Tiers->add(std::move(NewP));
+
+    renameForTier(*M, P, 1);
+    addCounters(*M, P, HotCalls);
+
+    orc::MangleAndInterner Mangle(JIT->getExecutionSession(), JIT->getDataLayout());
+    orc::SymbolAliasMap Aliases;
+    for (const std::string &Name : P.Functions)
+        Aliases[Mangle(Name)] = orc::SymbolAliasMapEntry(Mangle(Name+"."+P.Tag+".tier1"),
+            JITSymbolFlags::Exported | JITSymbolFlags::Callable);
+
+    orc::JITDylib &JD = JIT->getMainJITDylib();
+    if (auto Err = JD.define(orc::lazyReexports(*Tiers->CallThrough, *Tiers->Stubs, JD,
+            std::move(Aliases)), Code)) {
+        logAllUnhandledErrors(std::move(Err), errs(), "lljit: ");
+        return false;
+    }
+    if (auto Err = JIT->addIRModule(Code, orc::ThreadSafeModule(std::move(M), std::move(Ctx)))) {
+        logAllUnhandledErrors(std::move(Err), errs(), "lljit: ");
+        return false;
+    }
+    return true;
+}
+
+// Recompile this hot module with its profile, and point its stubs at
+//  the new code.  The first tier's code stays loaded, since a thread
+//  might still be running it.
+void ExampleJIT::tierUp(ExampleProfile &P)
+{
+    auto Ctx = std::make_unique<LLVMContext>();
+    std::unique_ptr<Module> M = addIR(MemoryBufferRef(P.IR, P.Tag), *Ctx);
+    if (!M) return;
+    addProfile(*M, P);
+    renameForTier(*M, P, 2);
+    if (auto Err = JIT->addIRModule(P.Code, orc::ThreadSafeModule(std::move(M), std::move(Ctx)))) {
+        logAllUnhandledErrors(std::move(Err), errs(), "lljit: "); // maybe removed
+        return;
+    }
+
+    orc::MangleAndInterner Mangle(JIT->getExecutionSession(), JIT->getDataLayout());
+    for (const std::string &Name : P.Functions) {
+        void *Code = lookup(Name+"."+P.Tag+".tier2");
+        if (!Code) continue;
+        ExitOnErr(Tiers->Stubs->updatePointer(*Mangle(Name), pointerToJITTargetAddress(Code)));
+    }
+    if (Verbose) {
+        std::lock_guard<std::mutex> Lock(PrintLock);
+        errs()<<"Recompiled hot module "<<P.Tag<<" with its profile\n";
+    }
+}
+
+
+/*********************** Hot reload *************************
+ Each version of a watched file gets compiled into its own ResourceTracker,
+ with its exported symbols renamed F.wN.vK, and callers reach each
+ exported function through a stub named F.  When the file changes, the
+ watcher thread compiles the new version, points the stubs at it, and
+ frees the old version once every CodeGuard that might be running it
+ has finished.  Within one version, functions call each other directly,
+ so a call that started in the old version finishes there.
+
+ Guards use two counters, like a tiny RCU: a guard counts itself in
+ Active[Epoch&1].  After switching the stubs, the watcher bumps Epoch
+ and waits for the old counter to drain.  Any guard that starts after
+ the switch can only reach the new code.
+*/
+
+// One watched file
+struct ExampleWatched {
+    std::string Filename;
+    std::string Tag; // makes this file's symbol names unique
+    int Version=0;
+    sys::TimePoint<> Modified; // file time of the loaded version
+    uint64_t Size=0;
+    orc::ResourceTrackerSP Code; // owns the current version's code
+    std::vector<std::string> Functions; // exported functions, which have stubs
+    std::vector<std::string> Globals; // exported variables
+};
+
+// Compiles new versions of watched files
+class ExampleReloader {
+public:
+    ExampleJIT &J;
+    std::unique_ptr<orc::IndirectStubsManager> Stubs;
+    std::atomic<unsigned> Epoch{0};
+    std::atomic<int> Active[2];
+    std::atomic<int> Reloads{0};
+
+    ExampleReloader(ExampleJIT &J_) :J(J_) {
+        Active[0] = Active[1] = 0;
+        Stubs = orc::createLocalIndirectStubsManagerBuilder(J.JIT->getTargetTriple())();
+    }
+
+    // Compile the first version of this file, and start watching it
+    bool add(const std::string &Filename) {
+        auto W = std::make_unique<ExampleWatched>();
+        W->Filename = Filename;
+        std::lock_guard<std::mutex> L(Lock);
+        W->Tag = "w"+std::to_string(Files.size());
+        if (!load(*W)) return false;
+        Files.push_back(std::move(W));
+        if (!Watcher.joinable()) Watcher = std::thread(&ExampleReloader::work, this);
+        return true;
+    }
+
+    // Return the current versioned name of this exported variable, or ""
+    std::string globalName(const std::string &Name) {
+        std::lock_guard<std::mutex> L(GlobalsLock);
+        auto G = Globals.find(Name);
+        return G==Globals.end() ? "" : G->second;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> L(Lock);
+            Stopping = true;
+            Wake.notify_one();
+        }
+        if (Watcher.joinable()) Watcher.join();
+    }
+
+private:
+    std::mutex Lock; // protects everything below but Globals (and is held during loads)
+    std::condition_variable Wake;
+    std::vector<std::unique_ptr<ExampleWatched>> Files;
+    // Lookups under a CodeGuard need Globals while load waits for that
+    //  guard to finish, so it has its own lock, held only briefly.
+    std::mutex GlobalsLock;
+    std::map<std::string, std::string> Globals; // variable name -> current versioned name
+    bool Stopping=false;
+    std::thread Watcher;
+
+    // Check the watched files a few times a second
+    void work() {
+        std::unique_lock<std::mutex> L(Lock);
+        while (!Stopping) {
+            Wake.wait_for(L, std::chrono::milliseconds(250));
+            for (auto &W : Files) {
+                sys::fs::file_status Status;
+                if (Stopping || sys::fs::status(W->Filename, Status)) continue;
+                if (Status.getLastModificationTime()==W->Modified && Status.getSize()==W->Size)
+                    continue;
+                if (load(*W)) Reloads++;
+            }
+        }
+    }
+
+    // Compile the next version of this file, and switch over to it.
+    //  On errors, we keep running the old version.
+    bool load(ExampleWatched &W) {
+        sys::fs::file_status Status;
+        auto Source = MemoryBuffer::getFile(W.Filename);
+        if (sys::fs::status(W.Filename, Status) || !Source) {
+            errs()<<"lljit: can't read "<<W.Filename<<"\n";
+            return false;
+        }
+        W.Modified = Status.getLastModificationTime(); // don't retry until it changes again
+        W.Size = Status.getSize();
+
+        double Start = timeNow();
+        auto Ctx = std::make_unique<LLVMContext>();
+        SMDiagnostic Smd;
+        std::unique_ptr<Module> M = parseIR(**Source, Smd, *Ctx);
+        J.addTime(&ExampleJIT::PhaseTimes::Parse, Start);
+        if (!M) {
+            Smd.print("lljit", errs());
+            return false;
+        }
+        if (auto Err = J.prepareModule(*M)) {
+            logAllUnhandledErrors(std::move(Err), errs(), "lljit: ");
+            return false;
+        }
+
+        // Rename this version's exported symbols
+        std::string Suffix = "."+W.Tag+".v"+std::to_string(W.Version+1);
+        std::vector<std::string> Functions, Globals;
+        for (GlobalValue &G : M->global_values()) {
+            if (G.isDeclaration() || G.hasLocalLinkage()) continue;
+            std::string Name = G.getName().str();
+            G.setName(Name+Suffix);
+            (isa<Function>(G) ? Functions : Globals).push_back(Name);
+        }
+        for (const std::string &Name : W.Functions)
+            if (std::find(Functions.begin(), Functions.end(), Name)==Functions.end()) {
+                errs()<<"lljit: "<<W.Filename<<" can't remove function "<<Name<<" while it's running\n";
+                return false;
+            }
+
+        // Compile it all now
+        orc::JITDylib &JD = J.JIT->getMainJITDylib();
+        orc::ResourceTrackerSP Code = JD.createResourceTracker();
+        if (auto Err = J.JIT->addIRModule(Code, orc::ThreadSafeModule(std::move(M), std::move(Ctx)))) {
+            logAllUnhandledErrors(std::move(Err), errs(), "lljit: ");
+            return false;
+        }
+        std::vector<JITTargetAddress> Addrs;
+        for (const std::string &Name : Functions) {
+            auto Addr = J.JIT->lookup(Name+Suffix); // not J.lookup, which takes our Lock
+            if (!Addr) {
+                logAllUnhandledErrors(Addr.takeError(), errs(), "lljit: ");
+                cantFail(Code->remove());
+                return false;
+            }
+#if LLVM_VERSION_MAJOR >= 15
+            Addrs.push_back(Addr->getValue());
+#else
+            Addrs.push_back(Addr->getAddress());
+#endif
+        }
+
+        // Point the stubs at the new version, making any new stubs we need
+        orc::MangleAndInterner Mangle(J.JIT->getExecutionSession(), J.JIT->getDataLayout());
+        orc::SymbolMap NewStubs;
+        for (size_t i=0; i<Functions.size(); i++) {
+            orc::SymbolStringPtr Name = Mangle(Functions[i]);
+            JITTargetAddress Addr = Addrs[i];
+            JITSymbolFlags Flags = JITSymbolFlags::Exported | JITSymbolFlags::Callable;
+            if (Stubs->findStub(*Name, false)) {
+                ExitOnErr(Stubs->updatePointer(*Name, Addr));
+            } else {
+                ExitOnErr(Stubs->createStub(*Name, Addr, Flags));
+                NewStubs[Name] = Stubs->findStub(*Name, false);
+            }
+        }
+        if (!NewStubs.empty())
+            if (auto Err = JD.define(orc::absoluteSymbols(std::move(NewStubs))))
+                logAllUnhandledErrors(std::move(Err), errs(), "lljit: ");
+
+        {
+            std::lock_guard<std::mutex> L(GlobalsLock);
+            for (const std::string &Name : W.Globals) this->Globals.erase(Name);
+            for (const std::string &Name : Globals) this->Globals[Name] = Name+Suffix;
+        }
+
+        orc::ResourceTrackerSP Old = W.Code;
+        W.Code = Code;
+        W.Version++;
+        W.Functions = Functions;
+        W.Globals = Globals;
+        if (J.Verbose) errs()<<"Loaded version "<<W.Version<<" of "<<W.Filename<<"\n";
+
+        // Free the old version, once nothing can be running it
+        if (Old) {
+            unsigned E = Epoch++;
+            while (Active[E&1] > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            if (auto Err = Old->remove())
+                logAllUnhandledErrors(std::move(Err), errs(), "lljit: ");
+        }
+        return true;
+    }
+};
+
+ExampleJIT::CodeGuard::CodeGuard(ExampleJIT &J)
+    :Active(0)
+{
+    ExampleReloader *R = J.Reloader.get();
+    if (!R) return;
+    while (true) {
+        unsigned E = R->Epoch;
+        Active = &R->Active[E&1];
+        (*Active)++;
+        if (R->Epoch == E) return; // the watcher will wait for us
+        (*Active)--; // the watcher may have already checked: try again
+    }
+}
+
+ExampleJIT::CodeGuard::~CodeGuard()
+{
+    if (Active) (*Active)--;
+}
+
+// Compile this file, and recompile it whenever it changes
+bool ExampleJIT::watchFile(const std::string &Filename)
+{
+    if (!Reloader) Reloader = std::make_unique<ExampleReloader>(*this);
+    return Reloader->add(Filename);
+}
+
+int ExampleJIT::getReloads()
+{
+    return Reloader ? (int)Reloader->Reloads : 0;
+}
+
+ExampleJIT::~ExampleJIT() {
+    // Stop our threads before the JIT goes away
+    if (Reloader) Reloader->stop();
+    if (Tiers) Tiers->stop();
+
+    // ResourceTrackers need the JIT's ExecutionSession, so drop ours first
+    Reloader.reset();
+    Tiers.reset();
+    SymbolModules.clear();
+    Modules.clear();
+    if (Slabs) Slabs->Closing = true; // the JIT's memory all goes at once
+}
+
+// Start profiling modules added from now on
+void ExampleJIT::setProfiling(uint64_t Calls)
+{
+    HotCalls = Calls;
+    if (HotCalls && !Tiers) Tiers = std::make_unique<ExampleTierUp>(*this);
+}
+
+int ExampleJIT::getTierUps()
+{
+    return Tiers ? (int)Tiers->TierUps : 0;
+}
+
+/*********************** Module memory *************************
+ Each name passed to addFile, addText, or addTexts gets an ExampleModule,
+ whose ResourceTracker owns the code and data of everything added under
+ that name, so removing the tracker frees it all.  Each module's
+ ExampleMemoryMapper counts the memory mapped for its sections.
+*/
+
+// Return the ResourceTracker for modules added under this name
+orc::ResourceTrackerSP ExampleJIT::moduleCode(const std::string &Name)
+{
+    std::lock_guard<std::mutex> Lock(ModulesLock);
+    std::shared_ptr<ExampleModule> &Mod = Modules[Name];
+    if (!Mod) {
+        Mod = std::make_shared<ExampleModule>(*Slabs);
+        Mod->Name = Name;
+        Mod->Code = JIT->getMainJITDylib().createResourceTracker();
+    }
+    Mod->LastUsed = ++Clock;
+    evictModules(Mod.get());
+    return Mod->Code;
+}
+
+// Object code is being loaded for R: return its module, if we track it
+std::shared_ptr<ExampleModule> ExampleJIT::emitting(orc::MaterializationResponsibility &R)
+{
+    orc::ResourceKey Key = 0;
+    if (auto Err = R.withResourceKeyDo([&](orc::ResourceKey K) { Key = K; })) {
+        consumeError(std::move(Err)); // already removed
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> Lock(ModulesLock);
+    for (auto &I : Modules)
+        if (I.second->Code->getKeyUnsafe() == Key) {
+            for (auto &Sym : R.getSymbols()) // objects from the cache have no IR
+                SymbolModules[(*Sym.first).str()] = I.second;
+            return I.second;
+        }
+    return nullptr;
+}
+
+// This symbol was just looked up, so its module was used
+void ExampleJIT::touch(const std::string &Symbol)
+{
+    std::lock_guard<std::mutex> Lock(ModulesLock);
+    auto S = SymbolModules.find(Symbol);
+    if (S == SymbolModules.end()) return;
+    S->second->LastUsed = ++Clock;
+    evictModules(S->second.get());
+}
+
+// If we're over the memory limit, remove the least recently used
+//  modules other than Keep.  Call with ModulesLock held.
+void ExampleJIT::evictModules(ExampleModule *Keep)
+{
+    if (!MemoryLimit) return;
+    while (true) {
+        size_t Total = 0;
+        std::shared_ptr<ExampleModule> Coldest;
+        for (auto &I : Modules) {
+            ExampleModule &Mod = *I.second;
+            Total += Mod.Memory.CodeBytes + Mod.Memory.DataBytes;
+            if (&Mod != Keep && (!Coldest || Mod.LastUsed < Coldest->LastUsed))
+                Coldest = I.second;
+        }
+        if (Total <= MemoryLimit || !Coldest) return;
+        if (Verbose) {
+            std::lock_guard<std::mutex> Lock(PrintLock);
+            errs()<<"Removing least recently used module "<<Coldest->Name<<"\n";
+        }
+        removeModule(Coldest);
+    }
+}
+
+// Free this module's code and data.  Call with ModulesLock held.
+void ExampleJIT::removeModule(std::shared_ptr<ExampleModule> Mod)
+{
+    if (auto Err = Mod->Code->remove())
+        logAllUnhandledErrors(std::move(Err), errs(), "lljit: ");
+    for (auto S = SymbolModules.begin(); S != SymbolModules.end(); )
+        if (S->second == Mod) S = SymbolModules.erase(S);
+        else ++S;
+    Modules.erase(Mod->Name);
+}
+
+bool ExampleJIT::removeModule(const std::string &Name)
+{
+    std::lock_guard<std::mutex> Lock(ModulesLock);
+    auto I = Modules.find(Name);
+    if (I == Modules.end()) return false;
+    removeModule(I->second);
+    return true;
+}
+
+std::vector<ExampleJIT::ModuleMemory> ExampleJIT::getModuleMemory()
+{
+    std::lock_guard<std::mutex> Lock(ModulesLock);
+    std::vector<ModuleMemory> Memory;
+    for (auto &I : Modules) {
+        ModuleMemory M;
+        M.Name = I.first;
+        M.Code = I.second->Memory.CodeBytes;
+        M.Data = I.second->Memory.DataBytes;
+        Memory.push_back(M);
+    }
+    return Memory;
+}
+
+void ExampleJIT::setMemoryLimit(size_t Bytes)
+{
+    std::lock_guard<std::mutex> Lock(ModulesLock);
+    MemoryLimit = Bytes;
+    evictModules(0);
+}
+
+
+/*********************** Runtime library *************************
+ setRuntime loads a bitcode library, usually runtime.bc (runtime.cpp
+ compiled by clang), and every module gets the runtime functions it calls
+ linked in before it's optimized.  The linked copies are internal and
+ always inlined, so a call to jit_min in a loop costs no more than the
+ compare it does.  The same functions are also in CallableFuncs, so
+ modules still link without the bitcode; they just make real calls.
+*/
+
+// Link this runtime bitcode library into modules added from now on
+bool ExampleJIT::setRuntime(const std::string &BitcodeFile)
+{
+    auto Buffer = MemoryBuffer::getFile(BitcodeFile);
+    if (!Buffer) {
+        errs()<<"lljit: can't read runtime "<<BitcodeFile<<": "<<Buffer.getError().message()<<"\n";
+        return false;
+    }
+    LLVMContext Ctx; // check that it's bitcode this LLVM can read
+    auto R = getLazyBitcodeModule(**Buffer, Ctx);
+    if (!R) {
+        logAllUnhandledErrors(R.takeError(), errs(), "lljit: bad runtime "+BitcodeFile+": ");
+        return false;
+    }
+
+    SHA1 Hash;
+    Hash.update((*Buffer)->getBuffer());
+    RuntimeHash = toHex(Hash.final(), true);
+    Runtime = std::move(*Buffer);
+    return true;
+}
+
+// Link the runtime functions that M calls into M, ready to inline
+Error ExampleJIT::linkRuntime(llvm::Module &M)
+{
+    if (!Runtime) return Error::success();
+    double Start = timeNow();
+
+    // Only bother reading the runtime if M calls something it doesn't define
+    bool Needed = false;
+    for (Function &F : M)
+        if (F.isDeclaration() && !F.isIntrinsic()) Needed = true;
+    if (!Needed) return Error::success();
+
+    // Functions are read from the bitcode only if they get linked
+    auto Lazy = getLazyBitcodeModule(*Runtime, M.getContext());
+    if (!Lazy) return Lazy.takeError();
+    std::unique_ptr<Module> R = std::move(*Lazy);
+    if (M.getTargetTriple().empty()) M.setTargetTriple(JIT->getTargetTriple().str());
+    if (M.getDataLayout().isDefault()) M.setDataLayout(JIT->getDataLayout());
+    R->setTargetTriple(M.getTargetTriple()); // it's the same machine
+    R->setDataLayout(M.getDataLayout());
+
+    // The linker reports problems to the context, whose default handler
+    //  exits on errors, so collect them here instead
+    LLVMContext &Ctx = M.getContext();
+    auto OldCallBack = Ctx.getDiagnosticHandlerCallBack();
+    void *OldContext = Ctx.getDiagnosticContext();
+    struct LinkProblems { std::string Text; bool Error=false; } Problems;
+    Ctx.setDiagnosticHandlerCallBack([](const DiagnosticInfo &DI, void *P) {
+        LinkProblems &Problems = *static_cast<LinkProblems *>(P);
+        raw_string_ostream OS(Problems.Text);
+        DiagnosticPrinterRawOStream DP(OS);
+        DI.print(DP);
+        OS<<"\n";
+        if (DI.getSeverity()==DS_Error) Problems.Error = true;
+    }, &Problems);
+
+    std::vector<std::string> Linked;
+    bool Failed = Linker::linkModules(M, std::move(R), Linker::Flags::LinkOnlyNeeded,
+        [&Linked](Module &Dest, const StringSet<> &GVS) {
+            for (const auto &Name : GVS) Linked.push_back(Name.getKey().str());
+            internalizeModule(Dest, [&GVS](const GlobalValue &GV) {
+                return !GV.hasName() || GVS.count(GV.getName()) == 0;
+            });
+        });
+    Ctx.setDiagnosticHandlerCallBack(OldCallBack, OldContext);
+    if (Failed || Problems.Error)
+        return createStringError(inconvertibleErrorCode(),
+            "can't link runtime into "+M.getModuleIdentifier()+": "+StringRef(Problems.Text).rtrim());
+    if (!Problems.Text.empty()) errs()<<"lljit: "<<Problems.Text; // warnings
+
+    // clang tags each function with the CPU it compiled for, which
+    //  would block inlining into code for a different CPU
+    for (const std::string &Name : Linked)
+        if (Function *F = M.getFunction(Name)) {
+            F->removeFnAttr("target-cpu");
+            F->removeFnAttr("target-features");
+            if (!F->hasFnAttribute(Attribute::NoInline))
+                F->addFnAttr(Attribute::AlwaysInline);
+        }
+    addTime(&PhaseTimes::Parse, Start);
+    return Error::success();
+}
+
+// Add our runtime, batch loops, and settings to this newly parsed Module
+Error ExampleJIT::prepareModule(llvm::Module &M)
+{
+    if (auto Err = linkRuntime(M))
+        return Err;
+
+    for (const std::string &Name : BatchWrappers)
+        if (Function *F = M.getFunction(Name))
+            if (!F->isDeclaration()) addBatchLoop(*F);
+
+    // Remember how to optimize it (this survives splitting for lazy compiles)
+    M.addModuleFlag(Module::Warning, OptLevelFlag,
+        MDString::get(M.getContext(), OptLevel));
+    return Error::success();
+}
+
+// Add this Module to our JIT.  It gets optimized and compiled when needed.
+bool ExampleJIT::addModule(std::unique_ptr<llvm::Module> M,
+    std::unique_ptr<llvm::LLVMContext> Ctx, orc::ResourceTrackerSP Code)
+{
+    if (!M) {
+        return false;
+    }
+
+    // ORC copies each module to a new context (through bitcode) when it
+    //  compiles it, so lazy bitcode has to be all here first.
+    if (auto Err = materialize(*M)) {
+        logAllUnhandledErrors(std::move(Err), errs(), "lljit: ");
+        return false;
+    }
+    if (auto Err = prepareModule(*M)) {
+        logAllUnhandledErrors(std::move(Err), errs(), "lljit: ");
+        return false;
+    }
+
+    // Lookups of its symbols count as uses of this module
+    bool Limited;
+    {
+        std::lock_guard<std::mutex> Lock(ModulesLock);
+        Limited = MemoryLimit != 0;
+        for (auto &I : Modules)
+            if (I.second->Code == Code)
+                for (GlobalValue &G : M->global_values())
+                    if (!G.isDeclaration() && !G.hasLocalLinkage())
+                        SymbolModules[G.getName().str()] = I.second;
+    }
+
+    if (HotCalls) return addProfiled(std::move(M), std::move(Ctx), Code);
+
+    // Cached modules need to be compiled as a whole, to save the object.
+    //  Lazily compiled functions live in ORC's own JITDylib, outside our
+    //  ResourceTracker, so with a memory limit we compile whole modules too.
+    bool Whole = !Lazy || Limited || ExampleObjectCache::isKey(M->getModuleIdentifier());
+
+    // (LLJIT's addLazyIRModule can't take a ResourceTracker, but its layer can)
+    if (M->getDataLayout().isDefault()) M->setDataLayout(JIT->getDataLayout());
+    orc::ThreadSafeModule TSM(std::move(M), std::move(Ctx));
+    Error Err = Whole ? JIT->addIRModule(Code, std::move(TSM))
+                      : JIT->getCompileOnDemandLayer().add(Code, std::move(TSM));
+    if (Err) { // like a symbol some other module already defines
+        logAllUnhandledErrors(std::move(Err), errs(), "lljit: ");
+        return false;
+    }
+    return true;
+}
+
+// Add this already-compiled object file to our JIT
+bool ExampleJIT::addObject(std::unique_ptr<MemoryBuffer> Obj, orc::ResourceTrackerSP Code)
+{
+    if (auto Err = JIT->addObjectFile(Code, std::move(Obj))) {
+        logAllUnhandledErrors(std::move(Err), errs(), "lljit: ");
+        return false;
+    }
+    return true;
+}
+
+// Add this LLVM IR source, or load it from the cache if we've
+//  compiled the same source before.
+bool ExampleJIT::addSource(MemoryBufferRef Source)
+{
+    orc::ResourceTrackerSP Code = moduleCode(Source.getBufferIdentifier().str());
+    std::string Key;
+    if (Cache->enabled() && !HotCalls) {
+        Key = cacheKey(Source.getBuffer());
+        if (auto Obj = Cache->getObject(Key)) { // no parse, optimize, or codegen
+            if (Verbose) {
+                std::lock_guard<std::mutex> Lock(PrintLock);
+                errs()<<"Loaded "<<Source.getBufferIdentifier()<<" from object cache "<<Cache->Dir<<"\n";
+            }
+            return addObject(std::move(Obj), Code);
+        }
+    }
+
+    // Each module gets its own LLVM context
+    auto Ctx = std::make_unique<LLVMContext>();
+
+    // Parse IR into a Module
+    std::unique_ptr<llvm::Module> M = addIR(Source, *Ctx);
+    if (M && !Key.empty()) M->setModuleIdentifier(Key); // so codegen saves the object
+    return addModule(std::move(M), std::move(Ctx), Code);
+}
+
+// Add this LLVM IR file
+bool ExampleJIT::addFile(const std::string &Filename)
+{
+    auto Source = MemoryBuffer::getFile(Filename);
+    if (!Source) {
+        errs()<<"lljit: can't read "<<Filename<<": "<<Source.getError().message()<<"\n";
+        return false;
+    }
+    return addSource(**Source);
+}
+
+// Add this LLVM IR text or bitcode
+bool ExampleJIT::addText(StringRef IR, StringRef Name)
+{
+    return addSource(MemoryBufferRef(IR, Name));
+}
+
+// Add the LLVM IR text or bitcode in this buffer
+bool ExampleJIT::addBuffer(MemoryBufferRef IR)
+{
+    return addSource(IR);
+}
+
+// Add these LLVM IR texts.  Each module gets its own context,
+//  so we can parse them all in parallel.
+bool ExampleJIT::addTexts(const std::vector<std::string> &IRs, const std::string &Name)
+{
+    size_t N = IRs.size();
+    std::vector<std::unique_ptr<LLVMContext>> Ctxs(N);
+    std::vector<std::unique_ptr<llvm::Module>> Ms(N);
+    std::vector<std::unique_ptr<MemoryBuffer>> Objs(N); // from the cache
+
+    // Each thread grabs the next module to work on
+    std::atomic<size_t> Next(0);
+    auto Worker = [&]() {
+        for (size_t i; (i = Next++) < N; ) {
+            std::string Key;
+            if (Cache->enabled() && !HotCalls) {
+                Key = cacheKey(IRs[i]);
+                if ((Objs[i] = Cache->getObject(Key))) continue;
+            }
+            Ctxs[i] = std::make_unique<LLVMContext>();
+            Ms[i] = addIR(MemoryBufferRef(IRs[i], Name+std::to_string(i)), *Ctxs[i]);
+            if (Ms[i] && !Key.empty()) Ms[i]->setModuleIdentifier(Key);
+        }
+    };
+    unsigned NThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> Threads;
+    for (unsigned t=0; t<NThreads && t<N; t++)
+        Threads.emplace_back(Worker);
+    for (std::thread &T : Threads)
+        T.join();
+
+    for (size_t i=0; i<N; i++) {
+        orc::ResourceTrackerSP Code = moduleCode(Name+std::to_string(i));
+        if (Objs[i] ? !addObject(std::move(Objs[i]), Code)
+                    : !addModule(std::move(Ms[i]), std::move(Ctxs[i]), Code))
+            return false;
+    }
+    return true;
+}
+
+// Return the in-memory address of this symbol
+void * ExampleJIT::lookup(const std::string &Symbol) {
+    std::string Name = Reloader ? Reloader->globalName(Symbol) : "";
+    auto SA = JIT->lookup(Name.empty() ? Symbol : Name);
+    if (auto Err = SA.takeError()) {
+        consumeError(std::move(Err));
+        return 0;
+    }
+    touch(Symbol);
+
+#if LLVM_VERSION_MAJOR >= 15
+    return reinterpret_cast<void *>((*SA).getValue());
+#else
+    return reinterpret_cast<void *>((*SA).getAddress());
+#endif
+}
+
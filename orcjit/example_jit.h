@@ -0,0 +1,362 @@
+/*
+Demonstrates a Just-In-Time (JIT) compiler using LLVM.
+
+An ExampleJIT compiles LLVM IR modules in memory and provides access
+to the functions inside them.  See example_jit.cpp for the implementation,
+and main.cpp for a small driver program.
+
+ * Copyright (C) 2020 Vaivaswatha N
+ * Modifications by Dr. Orion Lawlor and the CS 601 class, 2024.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef EXAMPLE_JIT_H
+#define EXAMPLE_JIT_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <stdint.h>
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+// Keeps compiled object files in a directory (see example_jit.cpp)
+class ExampleObjectCache;
+
+// The code and memory for modules added under one name (see example_jit.cpp)
+struct ExampleModule;
+class ExampleSlabPool;
+class ExampleMemoryMapper;
+
+// ExampleJIT's compile and link steps (see example_jit.cpp)
+class ExampleCompiler;
+class ExampleLinkingLayer;
+
+// Profile-guided recompilation of hot modules (see example_jit.cpp)
+class ExampleTierUp;
+struct ExampleProfile;
+
+// Hot reload of changed files (see example_jit.cpp)
+class ExampleReloader;
+
+
+// An ExampleJIT object compiles LLVM-IR modules and provides access
+// to the symbols inside them.  You can keep adding modules, and they
+// can call each other's functions.  Nothing gets optimized or compiled
+// until it's needed: by default each function is compiled on its first call.
+//
+// Modules are optimized and compiled on a pool of compile threads, so
+// independent modules compile in parallel.  It's safe to add modules
+// and look up symbols from several threads at once.
+class ExampleJIT {
+public:
+    // Seconds spent in each phase, summed over all modules and threads
+    struct PhaseTimes {
+        double Parse=0; // reading IR text into Modules
+        double Optimize=0; // running optimization passes
+        double Codegen=0; // making object code (or loading it from the cache)
+        double Link=0; // loading object code into memory and relocating it
+    };
+
+    // Bytes of JIT memory held by the modules added under one name
+    struct ModuleMemory {
+        std::string Name; // the file name, or the Name passed to addText
+        size_t Code=0; // machine code
+        size_t Data=0; // constants and global variables
+    };
+
+private:
+    friend class ExampleCompiler;
+    friend class ExampleLinkingLayer;
+    friend class ExampleTierUp;
+    friend class ExampleReloader;
+
+    bool OK=false;
+    bool Verbose=false; // print each module before and after optimization
+    bool Lazy=true; // compile each function on its first call
+    bool TimePasses=false; // print the time each optimization pass takes
+    bool Vectorize=true; // run the loop and SLP vectorizers
+    std::string OptLevel="O2"; // for modules added from now on
+    std::vector<std::string> BatchWrappers; // functions that get a .batch loop
+    std::mutex PrintLock; // keeps verbose output from different threads apart
+    std::unique_ptr<ExampleObjectCache> Cache; // compiled objects, see setCacheDir
+    std::string Target; // triple, CPU, and features we generate code for
+    std::unique_ptr<llvm::orc::JITTargetMachineBuilder> JTMB; // makes TargetMachines, see setTarget
+    std::mutex TimesLock; // protects Times
+    PhaseTimes Times;
+    ExampleLinkingLayer *Linker=0; // owned by JIT
+    uint64_t HotCalls=0; // calls before a profiled module is recompiled, 0 if not profiling
+    std::unique_ptr<ExampleTierUp> Tiers; // stubs and profiles, see setProfiling
+    std::unique_ptr<ExampleReloader> Reloader; // see watchFile
+    std::mutex ModulesLock; // protects everything through MemoryLimit
+    std::map<std::string, std::shared_ptr<ExampleModule>> Modules; // by name
+    std::map<std::string, std::shared_ptr<ExampleModule>> SymbolModules; // who defines each symbol
+    uint64_t Clock=0; // counts adds and lookups, for least-recently-used eviction
+    size_t MemoryLimit=0; // bytes, or 0 for no limit
+    std::unique_ptr<ExampleSlabPool> Slabs; // all JIT'd code and data lives here
+    std::unique_ptr<ExampleMemoryMapper> OtherMemory; // for code outside Modules
+    std::unique_ptr<llvm::MemoryBuffer> Runtime; // bitcode, see setRuntime
+    std::string RuntimeHash; // of Runtime, for cacheKey
+    std::unique_ptr<llvm::orc::LLLazyJIT> JIT; // last, so its compile threads stop first
+
+    void addTime(double PhaseTimes::*Phase, double Start);
+    llvm::Error addCallableFunctions(void);
+    std::unique_ptr<llvm::Module> addIR(llvm::MemoryBufferRef Source,
+        llvm::LLVMContext &Ctx);
+    std::string cacheKey(llvm::StringRef Source);
+    llvm::Error materialize(llvm::Module &M);
+    bool addObject(std::unique_ptr<llvm::MemoryBuffer> Obj,
+        llvm::orc::ResourceTrackerSP Code);
+    bool addSource(llvm::MemoryBufferRef Source);
+    void optimize(llvm::Module &M);
+    llvm::Error linkRuntime(llvm::Module &M);
+    llvm::Error prepareModule(llvm::Module &M);
+    bool checkBatchType(const std::string &Name, const std::string &Type);
+    bool addModule(std::unique_ptr<llvm::Module> M,
+        std::unique_ptr<llvm::LLVMContext> Ctx, llvm::orc::ResourceTrackerSP Code);
+    bool addProfiled(std::unique_ptr<llvm::Module> M,
+        std::unique_ptr<llvm::LLVMContext> Ctx, llvm::orc::ResourceTrackerSP Code);
+    llvm::orc::ResourceTrackerSP moduleCode(const std::string &Name);
+    std::shared_ptr<ExampleModule> emitting(llvm::orc::MaterializationResponsibility &R);
+    void touch(const std::string &Symbol);
+    void evictModules(ExampleModule *Keep);
+    void removeModule(std::shared_ptr<ExampleModule> Mod);
+    void tierUp(ExampleProfile &P);
+
+public:
+    // Set up an empty JIT, ready for addFile or addText.  Compilation runs
+    //  on this many threads; 0 compiles on the thread that needs the code.
+    explicit ExampleJIT(unsigned CompileThreads=std::thread::hardware_concurrency());
+
+    // Compile this LLVM IR file
+    ExampleJIT(const std::string &FileName);
+
+    ~ExampleJIT();
+
+    // Keep compiled object files in this directory, and reuse them
+    //  whenever the same IR gets added again, even in a later run.
+    //  Call this before adding any modules.
+    //  Returns false if the directory can't be created.
+    bool setCacheDir(const std::string &Dir);
+
+    // Add this LLVM IR file (assembly text, or .bc bitcode, which is much
+    //  faster to read), to be optimized and compiled when it's needed.
+    //  Prints the error and returns false if the file doesn't parse, or
+    //  defines a symbol that another module already defines.
+    bool addFile(const std::string &FileName);
+
+    // Add LLVM IR assembly text or bitcode that is already in memory,
+    //  like a std::string or a buffer your generator wrote bitcode into.
+    //  We copy what we need, so IR only needs to last until this returns.
+    //  Prints the error and returns false on error, like addFile.
+    bool addText(llvm::StringRef IR, llvm::StringRef Name="memory");
+
+    // Add the LLVM IR assembly text or bitcode in this buffer, named by
+    //  its identifier, like addText.
+    bool addBuffer(llvm::MemoryBufferRef IR);
+
+    // Parse several LLVM IR modules in parallel, and add them all.
+    //  Modules can call functions defined in the others.
+    bool addTexts(const std::vector<std::string> &IRs, const std::string &Name="memory");
+
+    // Link the functions of this runtime bitcode library (like runtime.bc,
+    //  see runtime.h) into each module added after this call, before it's
+    //  optimized, so calls to them can be inlined (except in lazy mode,
+    //  where each function is compiled separately).  Without it, calls
+    //  go to the copies compiled into this program.
+    //  Returns false if the file isn't bitcode.
+    bool setRuntime(const std::string &BitcodeFile);
+
+    // Remove the modules added under this name (the file name, or the
+    //  Name passed to addText or addTexts), and free their code and data.
+    //  Pointers into them become invalid, so nothing should be running
+    //  their code.  Functions already compiled lazily stay loaded, so
+    //  call setLazy(false) before adding modules you'll remove.
+    //  Returns false if there's no module with this name.
+    bool removeModule(const std::string &Name);
+
+    // Return the bytes of code and data memory held by each module
+    std::vector<ModuleMemory> getModuleMemory();
+
+    // Keep the total code and data memory of our modules under this many
+    //  bytes, by removing the least recently used modules (the ones
+    //  added or looked up longest ago).  0, the default, means no limit.
+    //  Like removeModule, this frees code, so only use it if you look up
+    //  a module's functions again before each call.  Watched files
+    //  aren't counted.
+    void setMemoryLimit(size_t Bytes);
+
+    // Hot reload: compile this LLVM IR file now, and keep watching it.
+    //  When the file changes, a background thread compiles the new version
+    //  and atomically switches the file's functions over to it.  A broken
+    //  new version is reported, and the old version keeps running.
+    //  Lookups of the file's functions return stubs that always call
+    //  the newest version; lookups of its variables return the current
+    //  version's copy.  Returns false if the first version doesn't compile.
+    bool watchFile(const std::string &FileName);
+
+    // Return the number of times watched files have been reloaded
+    int getReloads();
+
+    // Hold a CodeGuard while calling functions from watched files, so
+    //  a reload can't free their code while it's running:
+    //     { ExampleJIT::CodeGuard guard(jit); run(6, mem); }
+    //  Old versions are freed once the guards that might be running
+    //  them have finished, so code called without a guard can
+    //  disappear during a reload.
+    class CodeGuard {
+        std::atomic<int> *Active; // counts guards that might see this version
+    public:
+        CodeGuard(ExampleJIT &J);
+        ~CodeGuard();
+        CodeGuard(const CodeGuard &) = delete;
+        void operator=(const CodeGuard &) = delete;
+    };
+
+    // Get address for @Symbol inside the compiled IR, ready to be used.
+    //  This compiles the module containing it, or in lazy mode returns
+    //  a stub that compiles the function on its first call.
+    //  Returns NULL if the lookup failed.
+    void *lookup(const std::string &Symbol);
+
+    // Print each module before and after optimization
+    void setVerbose(bool V) { Verbose=V; }
+
+    // Optimize modules added after this call at this level: O0 compiles
+    //  fastest, O1 to O3 take longer to make faster code (the default
+    //  is O2), and Os and Oz make smaller code.  Also sets the codegen
+    //  optimization level.  Returns false for an unknown level.
+    bool setOptLevel(const std::string &Level);
+
+    // Generate code for this CPU, like "skylake-avx512", "x86-64", or "host"
+    //  (the default, which is the CPU we're running on with all its
+    //  features).  Features adds or removes features from the CPU's
+    //  own, like "+avx2,-avx512f".  Call this before adding modules.
+    void setTarget(const std::string &CPU, const std::string &Features="");
+
+    // Let the optimizer vectorize loops and straight-line code (the default)
+    //  at O2 and above.  Call this before adding modules.
+    void setVectorize(bool V) { Vectorize=V; }
+
+    // Print the time taken by each optimization pass, for each module
+    void setTimePasses(bool T) { TimePasses=T; }
+
+    // Get the address of this compiled function with this signature:
+    //     auto run = jit.get<long(long,void *)>("jitentry");
+    //  Returns NULL if the lookup failed.
+    template <typename Signature>
+    Signature *get(const std::string &Name) {
+        return reinterpret_cast<Signature *>(lookup(Name));
+    }
+
+    // In modules added after this call that define function Name, also
+    //  compile a loop Name.batch(const In *in, Out *out, int64_t n, args...)
+    //  that stores Name(in[i], args...) into out[i].  The loop is in the
+    //  same module, so the optimizer can inline and vectorize the calls
+    //  (except in lazy mode, where each function is compiled separately).
+    void addBatchWrapper(const std::string &Name) { BatchWrappers.push_back(Name); }
+
+    // Store Name(in[i], args...) into out[i] for each of n inputs, using
+    //  the compiled .batch loop if there is one.  With several threads,
+    //  each gets a contiguous piece of the arrays, so Name should be
+    //  safe to call from several threads with these args.
+    //  Returns false if there's no function Name, or if the .batch loop
+    //  was compiled for other types (see batchType).
+    template <typename Out, typename In, typename... Args>
+    bool batch(const std::string &Name, const In *in, Out *out, size_t n,
+        unsigned threads=1, Args... args)
+    {
+        auto Loop = get<void(const In *, Out *, int64_t, Args...)>(Name+".batch");
+        if (Loop && !checkBatchType(Name, typeName<Out>()+"("+typeNames<In, Args...>()+")"))
+            return false;
+        auto Scalar = Loop ? 0 : get<Out(In, Args...)>(Name);
+        if (!Loop && !Scalar) return false;
+
+        auto Work = [=](size_t start, size_t end) {
+            if (Loop) Loop(in+start, out+start, end-start, args...);
+            else for (size_t i=start; i<end; i++) out[i] = Scalar(in[i], args...);
+        };
+        if (threads<=1 || n<threads) {
+            Work(0, n);
+            return true;
+        }
+        std::vector<std::thread> Threads;
+        for (unsigned t=0; t<threads; t++)
+            Threads.emplace_back(Work, n*t/threads, n*(t+1)/threads);
+        for (std::thread &T : Threads)
+            T.join();
+        return true;
+    }
+
+    // Return the type of function Name's .batch loop, like "i32(i32,ptr)"
+    //  for i32 @Name(i32, i32*), or "" if it has no .batch loop.
+    std::string batchType(const std::string &Name);
+
+    // Describe this C++ type like batchType does: "i32", "float", "ptr"...
+    template <typename T>
+    static std::string typeName() {
+        if (std::is_pointer<T>::value) return "ptr";
+        if (std::is_same<T, float>::value) return "float";
+        if (std::is_same<T, double>::value) return "double";
+        if (std::is_integral<T>::value) return "i"+std::to_string(8*sizeof(T));
+        return "?";
+    }
+    template <typename T, typename... More>
+    static std::string typeNames() {
+        std::string S = typeName<T>();
+        for (const std::string &M : std::vector<std::string>{typeName<More>()...})
+            S += ","+M;
+        return S;
+    }
+
+    // Profile-guided recompilation: modules added after this call are
+    //  first compiled with counters on each function entry and each
+    //  branch.  Once any function in a module has been called HotCalls
+    //  times, a background thread recompiles the module using the counts
+    //  as branch weights and function entry counts, and switches callers
+    //  (which go through a stub for each function) to the new code.
+    //  0, the default, turns this off.  Profiled modules skip the cache.
+    void setProfiling(uint64_t HotCalls);
+
+    // Return the number of modules recompiled with profiles so far
+    int getTierUps();
+
+    // Return the time spent so far in each phase of compilation
+    PhaseTimes getPhaseTimes();
+
+    // Describe each function compiled from now on to Linux perf, so
+    //  "perf record -k 1" and "perf inject --jit" can attribute samples
+    //  to JIT'd functions.  (gdb always knows about JIT'd functions.)
+    //  Returns false if this LLVM was built without perf support.
+    bool enablePerf();
+
+    // Lazy (the default) compiles each function on its first call.
+    //  Otherwise a lookup compiles the whole module it's in, and the
+    //  modules it calls.  This affects modules added after the call.
+    //  Modules loaded from or saved to the object cache are never lazy,
+    //  and neither are modules added with a memory limit.
+    void setLazy(bool L) { Lazy=L; }
+
+    // Check if we're OK
+    operator bool () { return OK; }
+};
+
+// Print this area as hexadecimal bytes (see runtime.h)
+extern "C" void print_hex(void *ptr,int len);
+
+// Print this long integer onscreen (see runtime.h)
+extern "C" void print_long(long v);
+
+#endif
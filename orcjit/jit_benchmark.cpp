@@ -0,0 +1,239 @@
+/*
+Measures how long ExampleJIT takes to get LLVM IR running, and how fast
+the result runs, at each optimization level.
+
+For each IR file (by default the examples in ../llvm/examples) and each
+generated module (N small functions called from jitentry), at each level,
+given to the JIT as IR text and as bitcode:
+  - parse, optimize, codegen, and link time (from getPhaseTimes)
+  - first call latency: from handing the IR to the JIT until the first
+    call of the entry point returns
+  - steady-state call time, averaged over many calls
+
+Results are JSON on stdout, so runs can be saved and compared between
+versions; progress goes to stderr.
+
+Build and run with:
+ make benchmark
+or
+ ./jit_benchmark -levels O0,O2 -sizes 10,100 ../llvm/examples/loop.ll > loop.json
+ ./jit_benchmark -levels O0 -formats text,bitcode -sizes 10000 > parse.json
+
+ * Dr. Orion Lawlor and the CS 601 class, 2024 (Public Domain)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "example_jit.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Seconds since some arbitrary start point
+double time_now(void) {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Split "a,b,c" at the commas
+std::vector<std::string> split(const std::string &list) {
+    std::vector<std::string> parts;
+    std::stringstream in(list);
+    for (std::string part; std::getline(in, part, ','); )
+        if (!part.empty()) parts.push_back(part);
+    return parts;
+}
+
+// One module to benchmark
+struct bench_module {
+    std::string name; // file name, or "generated-N"
+    std::string ir; // LLVM IR text
+    std::string bitcode; // the same IR as bitcode
+    std::string entry; // function to call, as long entry(long arg0, void *mem)
+    int functions; // defined functions
+};
+
+// Read an IR file.  Its entry point is jitentry, or else its first function.
+bench_module read_module(const std::string &filename) {
+    std::ifstream file(filename);
+    if (!file) {
+        fprintf(stderr, "Can't read %s\n", filename.c_str());
+        exit(1);
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+
+    bench_module m;
+    m.name = filename.substr(filename.rfind('/')+1);
+    m.ir = text.str();
+    m.functions = 0;
+    std::istringstream lines(m.ir);
+    for (std::string line; std::getline(lines, line); ) {
+        if (line.compare(0, 7, "define ")) continue;
+        m.functions++;
+        size_t at = line.find('@'), paren = line.find('(', at);
+        std::string name = line.substr(at+1, paren-at-1);
+        if (m.entry.empty() || name == "jitentry") m.entry = name;
+    }
+    return m;
+}
+
+// Make a module with n functions, each a small loop with a branch,
+//  and a jitentry that calls them all.
+bench_module generate_module(int n) {
+    std::ostringstream ir;
+    for (int f=0; f<n; f++) {
+        ir << "define i64 @f" << f << "(i64 %x) {\n"
+              "entry:\n"
+              "  br label %loop\n"
+              "loop:\n"
+              "  %i = phi i64 [ 0, %entry ], [ %inext, %next ]\n"
+              "  %sum = phi i64 [ 0, %entry ], [ %sumnext, %next ]\n"
+              "  %odd = and i64 %i, 1\n"
+              "  %isodd = icmp ne i64 %odd, 0\n"
+              "  br i1 %isodd, label %addodd, label %addeven\n"
+              "addodd:\n"
+              "  %m = mul i64 %i, " << (f*7+3) << "\n"
+              "  %a = xor i64 %m, %x\n"
+              "  br label %next\n"
+              "addeven:\n"
+              "  %b = add i64 %i, " << f << "\n"
+              "  br label %next\n"
+              "next:\n"
+              "  %v = phi i64 [ %a, %addodd ], [ %b, %addeven ]\n"
+              "  %sumnext = add i64 %sum, %v\n"
+              "  %inext = add i64 %i, 1\n"
+              "  %more = icmp slt i64 %inext, 16\n"
+              "  br i1 %more, label %loop, label %done\n"
+              "done:\n"
+              "  ret i64 %sumnext\n"
+              "}\n\n";
+    }
+    ir << "define i64 @jitentry(i64 %arg0, i8* %mem) {\n"
+          "  %s0 = add i64 0, 0\n";
+    for (int f=0; f<n; f++)
+        ir << "  %r" << f << " = call i64 @f" << f << "(i64 %arg0)\n"
+              "  %s" << f+1 << " = add i64 %s" << f << ", %r" << f << "\n";
+    ir << "  ret i64 %s" << n << "\n}\n";
+
+    bench_module m;
+    m.name = "generated-" + std::to_string(n);
+    m.ir = ir.str();
+    m.entry = "jitentry";
+    m.functions = n+1;
+    return m;
+}
+
+// Convert this IR text to bitcode
+std::string to_bitcode(const bench_module &m) {
+    llvm::LLVMContext ctx;
+    llvm::SMDiagnostic err;
+    auto mod = llvm::parseIR(llvm::MemoryBufferRef(m.ir, m.name), err, ctx);
+    if (!mod) {
+        err.print(m.name.c_str(), llvm::errs());
+        exit(1);
+    }
+    std::string bitcode;
+    llvm::raw_string_ostream out(bitcode);
+    llvm::WriteBitcodeToFile(*mod, out);
+    return out.str();
+}
+
+// Compile and run this module at this optimization level, from this
+//  format ("text" or "bitcode"), and print its results as a JSON object.
+bool benchmark(const bench_module &m, const std::string &level,
+    const std::string &format, bool first) {
+    ExampleJIT jit;
+    jit.setLazy(false); // so the first lookup compiles everything
+    if (!jit || !jit.setOptLevel(level)) return false;
+
+    const std::string &ir = format=="bitcode" ? m.bitcode : m.ir;
+    double start = time_now();
+    if (!jit.addText(ir, m.name)) return false;
+    auto run = jit.get<long(long arg0, void *mem)>(m.entry);
+    if (!run) {
+        fprintf(stderr, "No function %s in %s\n", m.entry.c_str(), m.name.c_str());
+        return false;
+    }
+    void *mem = 0;
+    const int *memsize = jit.get<const int>("jitmemsize");
+    if (memsize) mem = calloc(*memsize, sizeof(int));
+    volatile long result = run(6, mem);
+    double first_call = time_now()-start;
+
+    // Call it for at least 0.2 seconds to get the steady-state time,
+    //  doubling the calls between clock checks so slow code stops soon
+    long calls = 0;
+    start = time_now();
+    double elapsed = 0;
+    for (long reps=1; elapsed < 0.2; reps*=2) {
+        for (long rep=0; rep<reps; rep++) result = run(6, mem);
+        calls += reps;
+        elapsed = time_now()-start;
+    }
+    free(mem);
+    (void)result;
+
+    ExampleJIT::PhaseTimes phases = jit.getPhaseTimes();
+    printf("%s    {\"module\": \"%s\", \"functions\": %d, \"format\": \"%s\", \"ir_bytes\": %zu, \"opt\": \"%s\",\n"
+           "     \"parse_ms\": %.3f, \"optimize_ms\": %.3f, \"codegen_ms\": %.3f, \"link_ms\": %.3f,\n"
+           "     \"first_call_ms\": %.3f, \"call_ns\": %.3f, \"calls_per_sec\": %.0f}",
+        first ? "" : ",\n", m.name.c_str(), m.functions, format.c_str(), ir.size(), level.c_str(),
+        phases.Parse*1.0e3, phases.Optimize*1.0e3, phases.Codegen*1.0e3, phases.Link*1.0e3,
+        first_call*1.0e3, elapsed*1.0e9/calls, calls/elapsed);
+    fflush(stdout);
+    fprintf(stderr, "%s %s at %s: parse %.3f ms, first call %.3f ms, %.3f ns/call\n",
+        m.name.c_str(), format.c_str(), level.c_str(), phases.Parse*1.0e3,
+        first_call*1.0e3, elapsed*1.0e9/calls);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<std::string> levels = split("O0,O1,O2,O3");
+    std::vector<std::string> sizes = split("10,100,1000");
+    std::vector<std::string> formats = split("text,bitcode");
+    std::vector<std::string> files;
+    for (int argi=1; argi<argc; argi++) {
+        if (0==strcmp(argv[argi],"-levels") && argi+1<argc) levels = split(argv[++argi]);
+        else if (0==strcmp(argv[argi],"-sizes") && argi+1<argc) sizes = split(argv[++argi]);
+        else if (0==strcmp(argv[argi],"-formats") && argi+1<argc) formats = split(argv[++argi]);
+        else files.push_back(argv[argi]);
+    }
+    if (files.empty())
+        for (const char *name : {"loop", "phi", "alloca_vs_phi", "optimize", "vector"})
+            files.push_back(std::string("../llvm/examples/") + name + ".ll");
+
+    std::vector<bench_module> modules;
+    for (const std::string &file : files) {
+        bench_module m = read_module(file);
+#if LLVM_VERSION_MAJOR < 15
+        if (std::regex_search(m.ir, std::regex("\\bptr\\b"))) {
+            fprintf(stderr, "Skipping %s: it uses opaque pointers, which need LLVM 15\n", file.c_str());
+            continue;
+        }
+#endif
+        modules.push_back(m);
+    }
+    for (const std::string &size : sizes) modules.push_back(generate_module(atoi(size.c_str())));
+    for (bench_module &m : modules) m.bitcode = to_bitcode(m);
+
+    printf("{\"llvm\": \"%s\", \"results\": [\n", LLVM_VERSION_STRING);
+    bool first = true;
+    for (const bench_module &m : modules)
+        for (const std::string &level : levels)
+            for (const std::string &format : formats) {
+                if (!benchmark(m, level, format, first)) return 1;
+                first = false;
+            }
+    printf("\n]}\n");
+    return 0;
+}
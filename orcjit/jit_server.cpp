@@ -0,0 +1,223 @@
+/*
+A long-running JIT compile server: keeps one ExampleJIT warm, so each
+request only pays for compiling its own IR, not for starting a process,
+initializing LLVM, and building a new JIT.
+
+Requests come in on stdin (or a Unix socket, with -socket path), one
+per line, and each gets a one-line reply starting with "ok" or "error":
+
+ module NAME BYTES    then BYTES of LLVM IR text (up to 64 MB): adds
+                      (or replaces) the module NAME.  Replies "ok parse
+                      MS ms".  If a replacement doesn't compile, the old
+                      version is added back.
+ call FUNC [ARG]      calls long FUNC(long ARG, void *mem), with mem
+                      sized by jitmemsize if some module defines it.
+                      Replies "ok RESULT compile MS ms run MS ms", where
+                      compile is the lookup, which compiles FUNC's module
+                      the first time.
+ remove NAME          frees the module NAME
+ stats                phase times and module memory, as one line
+ quit                 stops the server
+
+Modules share one symbol table, so two modules can't define the same
+function; replace a module by sending it again under the same name.
+
+Build and run with:
+ make jit_server
+ (printf 'module in %d\n' `wc -c < in.ll`; cat in.ll; echo call jitentry 6) | ./jit_server
+or serve clients one at a time on a socket:
+ ./jit_server -socket /tmp/jit.sock &
+ socat - UNIX-CONNECT:/tmp/jit.sock
+
+ * Dr. Orion Lawlor and the CS 601 class, 2024 (Public Domain)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <chrono>
+#include <map>
+#include <string>
+
+#include "example_jit.h"
+
+// Seconds since some arbitrary start point
+double time_now(void) {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class jit_server {
+    ExampleJIT &jit;
+    std::map<std::string, std::string> modules; // IR text of each module we've added
+    enum { max_module_bytes = 64<<20 }; // so a bad size can't exhaust memory
+    std::map<std::string, void *> symbols; // lookups, cleared when modules go away
+
+    // Look up this symbol, or return the cached address
+    void *lookup(const std::string &name) {
+        auto found = symbols.find(name);
+        if (found != symbols.end()) return found->second;
+        void *addr = jit.lookup(name);
+        if (addr) symbols[name] = addr;
+        return addr;
+    }
+
+    // Remove this module, and forget everything we looked up
+    bool remove(const std::string &name) {
+        if (!modules.erase(name)) return false;
+        symbols.clear(); // we don't know which module each symbol was in
+        return jit.removeModule(name);
+    }
+
+    void add_module(FILE *in, FILE *out, const std::string &name, long bytes) {
+        if (bytes<0 || bytes>max_module_bytes) {
+            fprintf(out, "error module %s: size %ld isn't 0 to %d bytes\n", name.c_str(), bytes, (int)max_module_bytes);
+            return;
+        }
+        std::string ir(bytes, '\0');
+        if (fread(&ir[0], 1, bytes, in) != (size_t)bytes) {
+            fprintf(out, "error module %s: expected %ld bytes of IR\n", name.c_str(), bytes);
+            return;
+        }
+
+        // Both versions define the same symbols, so the old one has to go
+        //  first; keep its IR in case the new one doesn't compile.
+        auto found = modules.find(name);
+        bool replacing = found != modules.end();
+        std::string old = replacing ? std::move(found->second) : "";
+        remove(name);
+        double parse = jit.getPhaseTimes().Parse;
+        if (!jit.addText(ir, name)) {
+            jit.removeModule(name); // may have been created before the error
+            bool kept = replacing && jit.addText(old, name);
+            if (kept) modules[name] = std::move(old);
+            fprintf(out, "error module %s doesn't compile (see the server's stderr)%s\n",
+                name.c_str(), kept ? ", kept the old version" : "");
+            return;
+        }
+        modules[name] = std::move(ir);
+        fprintf(out, "ok parse %.3f ms\n", (jit.getPhaseTimes().Parse-parse)*1.0e3);
+    }
+
+    void call(FILE *out, const std::string &func, long arg) {
+        double start = time_now();
+        auto run = (long (*)(long, void *))lookup(func);
+        if (!run) {
+            fprintf(out, "error no function %s\n", func.c_str());
+            return;
+        }
+        const int *memsize = (const int *)lookup("jitmemsize");
+        double compile = time_now()-start;
+
+        void *mem = memsize ? calloc(*memsize, sizeof(int)) : 0;
+        start = time_now();
+        long result = run(arg, mem);
+        double t = time_now()-start;
+        free(mem);
+        fprintf(out, "ok %ld compile %.3f ms run %.3f ms\n", result, compile*1.0e3, t*1.0e3);
+    }
+
+    void stats(FILE *out) {
+        ExampleJIT::PhaseTimes phases = jit.getPhaseTimes();
+        fprintf(out, "ok parse %.3f ms, optimize %.3f ms, codegen %.3f ms, link %.3f ms",
+            phases.Parse*1.0e3, phases.Optimize*1.0e3, phases.Codegen*1.0e3, phases.Link*1.0e3);
+        for (const ExampleJIT::ModuleMemory &m : jit.getModuleMemory())
+            fprintf(out, "; %s: %zu bytes of code, %zu bytes of data", m.Name.c_str(), m.Code, m.Data);
+        fprintf(out, "\n");
+    }
+
+public:
+    jit_server(ExampleJIT &jit_) :jit(jit_) {}
+
+    // Answer requests from in until it ends.  Returns false after a quit.
+    bool serve(FILE *in, FILE *out) {
+        char line[1024], word[256], name[256];
+        while (fgets(line, sizeof(line), in)) {
+            long num = 0;
+            int n = sscanf(line, "%255s %255s %ld", word, name, &num);
+            if (n < 1) continue; // blank line
+            std::string cmd = word;
+            if (cmd=="module" && n==3) add_module(in, out, name, num);
+            else if (cmd=="call" && n>=2) call(out, name, num);
+            else if (cmd=="remove" && n==2) {
+                if (remove(name)) fprintf(out, "ok\n");
+                else fprintf(out, "error no module %s\n", name);
+            }
+            else if (cmd=="stats") stats(out);
+            else if (cmd=="quit") {
+                fprintf(out, "ok\n");
+                fflush(out);
+                return false;
+            }
+            else fprintf(out, "error bad request: %s", line);
+            fflush(out);
+        }
+        return true;
+    }
+};
+
+// Serve clients on this Unix socket, one at a time, until one says quit
+int serve_socket(jit_server &server, const char *path) {
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (s<0 || strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Can't make socket %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) || listen(s, 8)) {
+        perror(path);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN); // a client leaving shouldn't kill the server
+    fprintf(stderr, "Serving on %s\n", path);
+
+    for (bool running=true; running; ) {
+        int c = accept(s, 0, 0);
+        if (c<0) continue;
+        FILE *in = fdopen(c, "r"), *out = fdopen(dup(c), "w");
+        running = server.serve(in, out);
+        fclose(in);
+        fclose(out);
+    }
+    close(s);
+    unlink(path);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *socketpath = 0;
+    const char *cachedir = 0;
+    const char *runtime = "runtime.bc";
+    const char *optlevel = "O2";
+    for (int argi=1; argi<argc; argi++) {
+        if (0==strcmp(argv[argi],"-socket") && argi+1<argc) socketpath = argv[++argi];
+        else if (0==strcmp(argv[argi],"-cache") && argi+1<argc) cachedir = argv[++argi];
+        else if (0==strcmp(argv[argi],"-runtime") && argi+1<argc) runtime = argv[++argi];
+        else if (argv[argi][0]=='-' && argv[argi][1]=='O') optlevel = argv[argi]+1;
+        else {
+            fprintf(stderr, "Usage: jit_server [-socket path] [-cache dir] [-runtime file.bc] [-O2]\n");
+            return 1;
+        }
+    }
+
+    // All the setup happens once, here
+    double start = time_now();
+    ExampleJIT jit;
+    jit.setLazy(false); // so modules can be replaced and removed
+    if (!jit || !jit.setOptLevel(optlevel)) return 1;
+    if (cachedir && !jit.setCacheDir(cachedir)) return 1;
+    if (strcmp(runtime,"none")!=0 && access(runtime,R_OK)==0 && !jit.setRuntime(runtime)) return 1;
+    fprintf(stderr, "JIT ready in %.3f ms\n", (time_now()-start)*1.0e3);
+
+    jit_server server(jit);
+    if (socketpath) return serve_socket(server, socketpath);
+    server.serve(stdin, stdout);
+    return 0;
+}
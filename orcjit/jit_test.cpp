@@ -0,0 +1,57 @@
+/*
+Checks ExampleJIT behavior that's easy to break without noticing.
+Prints what failed and exits with an error if anything did.
+
+Build and run with:
+ make test
+
+ * Dr. Orion Lawlor and the CS 601 class, 2024 (Public Domain)
+*/
+#include <stdio.h>
+#include <string>
+
+#include "example_jit.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+// Add IR text that's only a slice of a bigger buffer: the text after the
+//  slice isn't valid IR, and there's no null right after the slice.
+static void test_slices() {
+    const std::string ir = "define i64 @jitentry(i64 %x) {\n"
+                           "  %r = add i64 %x, 1\n"
+                           "  ret i64 %r\n"
+                           "}\n";
+    std::string buffer = ir + "this is not IR\n";
+    llvm::StringRef slice(buffer.data(), ir.size());
+
+    {
+        ExampleJIT jit;
+        check(jit && jit.addText(slice, "slice"), "addText of a slice");
+        auto entry = jit.get<long(long)>("jitentry");
+        check(entry && entry(41) == 42, "running addText of a slice");
+    }
+    {
+        ExampleJIT jit;
+        check(jit && jit.addBuffer(llvm::MemoryBufferRef(slice, "slice")), "addBuffer of a slice");
+        auto entry = jit.get<long(long)>("jitentry");
+        check(entry && entry(1) == 2, "running addBuffer of a slice");
+    }
+}
+
+int main() {
+    test_slices();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
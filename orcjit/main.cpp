@@ -4,305 +4,188 @@ Demonstrates a Just-In-Time (JIT) compiler using LLVM
 Once LLVM is set up, compile this file with:
  make
 or
- clang++ main.cpp `llvm-config --cxxflags --ldflags --system-libs --libs core orcjit native` -o jit
+ clang++ main.cpp example_jit.cpp runtime.cpp `llvm-config --cxxflags --ldflags --system-libs --libs core orcjit native passes linker` -o jit
 
 Run a LLVM IR file in.ll with:
  ./jit
 
-Make a new input.ll with:
- clang -S -emit-llvm input.c 
+Or run another IR file, keeping compiled code in a cache directory
+so later runs skip optimization and codegen:
+ ./jit -cache jitcache file.ll
+
+Or only compile the functions that actually get called:
+ ./jit -lazy file.ll
+
+Time a million calls to jitentry, through a compiled batch loop:
+ ./jit -batch 1000000 file.ll
+
+Count branches for the first 10000 calls, then recompile with that profile:
+ ./jit -profile 10000 -batch 1000000 file.ll
+
+Generate code for another CPU (the default is this machine's CPU),
+or turn off the vectorizers, and compare the run times:
+ ./jit -mcpu=x86-64 ../llvm/examples/vector.ll
+ ./jit -novec ../llvm/examples/vector.ll
+
+Profile the JIT'd code with Linux perf (see README.md):
+ perf record -k 1 ./jit -perf file.ll
+
+Keep running jitentry once a second, recompiling file.ll whenever
+you save a change to it:
+ ./jit -watch file.ll
+
+Link in a different runtime library (the default is runtime.bc,
+if it's there; see runtime.h), or -runtime none for no library:
+ ./jit -runtime myruntime.bc file.ll
 
+Pick an optimization level (the default is -O2), and see where
+the optimizer spends its time:
+ ./jit -O3 -time-passes file.ll
 
-This is a single-file version collected from the files at:
-     https://github.com/vaivaswatha/lljit
+Make a new input.ll with:
+ clang -S -emit-llvm input.c 
 
-Dr. Orion Lawlor heavily modified this 2024-02-21 by:
-   - Simplify by removing most llvm::Expected, to use inline error handling.
-   - Add raw machine code dump to check disassembly
-   - Add optimizer passes following this obsolete gist:
-        https://gist.github.com/5pilow/c7b6d3b21cc93eadd1eb298d2d86c2b6
+The JIT itself is in example_jit.h and example_jit.cpp.
 
  * Copyright (C) 2020 Vaivaswatha N
+ * Modifications by Dr. Orion Lawlor and the CS 601 class, 2024.
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
  * the Free Software Foundation, either version 3 of the License, or
  * (at your option) any later version.
- *
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
-#include <memory>
-#include <string>
 #include <stdio.h>
-
-
-#include "llvm/Support/CommandLine.h"
-#include "llvm/Support/raw_ostream.h"
-
-#include "llvm/ADT/StringRef.h"
-#include "llvm/ExecutionEngine/JITEventListener.h"
-#include "llvm/ExecutionEngine/ObjectCache.h"
-#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
-#include "llvm/ExecutionEngine/Orc/Core.h"
-#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
-#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
-#include "llvm/ExecutionEngine/Orc/LLJIT.h"
-#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
-#include "llvm/ExecutionEngine/SectionMemoryManager.h"
-#include "llvm/IR/DataLayout.h"
-#include "llvm/IR/LLVMContext.h"
-#include "llvm/IR/LegacyPassManager.h"
-#include "llvm/IRReader/IRReader.h"
-#include "llvm/Support/SourceMgr.h"
-#include "llvm/Support/TargetSelect.h"
-#include "llvm/Support/raw_ostream.h"
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar.h"
-#include "llvm/Transforms/Scalar/GVN.h"
-#include "llvm/Transforms/Utils.h"
-#include "llvm/Transforms/IPO/Inliner.h"
-
-#include "llvm/ADT/StringMap.h"
-#include "llvm/ExecutionEngine/ObjectCache.h"
-#include "llvm/ExecutionEngine/Orc/LLJIT.h"
-#include "llvm/Support/Error.h"
-#include "llvm/Support/MemoryBuffer.h"
-
-
-// An ExampleJIT object compiles an LLVM-IR module and provides access
-// to the symbols inside it. TODO: Handle multiple modules.
-class ExampleJIT {
-private:
-    bool OK=false;
-    std::unique_ptr<llvm::orc::LLJIT> JIT;
-    std::unique_ptr<llvm::LLVMContext> Ctx;
-
-    llvm::Error addCallableFunctions(void);
-    std::unique_ptr<llvm::Module> addIR(const std::string &Filename);
-    void optimize(const std::unique_ptr<llvm::Module> &M);
-
-public:
-    // Compile this LLVM IR file
-    ExampleJIT(const std::string &FileName);
-
-    // Get address for @Symbol inside the compiled IR, ready to be used.
-    //  Returns NULL if the lookup failed.
-    void *lookup(const std::string &Symbol);
-    
-    // Check if we're OK
-    operator bool () { return OK; }
-};
-
-
-
-using namespace llvm;
-
-// Error handling strategy
-ExitOnError ExitOnErr;
-
-
-// Print this area as hexadecimal bytes
-extern "C"
-void print_hex(void *ptr,int len)
-{
-    unsigned char *data=(unsigned char *)ptr;
-    printf("Code: \necho ");
-    for (int i=0;i<len;i++) printf("%02x ",data[i]);
-    printf(" | xxd -r -p | ndisasm -b 64 -\n\n");
-}
-
-// Print this long integer onscreen
-extern "C" 
-void print_long(long v) 
-{
-    printf(" long: %ld\n",v);
-}
-
-
-
-// Map function names to addresses:
-struct FunctionsMap {
-    const char *FName;
-    const void *FAddr;
-};
-const static FunctionsMap CallableFuncs[] = {
-    {"printf", (void *)printf},
-    {"puts", (void *)puts}, //< optimizer will swap printf call to puts
-    {"malloc", (void *)malloc},
-    {"exit", (void *)exit},
-    {"print_long", (void *)print_long}, //<- can also call local functions
-    {"print_hex", (void *)print_hex}, //<- can also call local functions
-};
-
-// Add functions in the table above that the JIT'ed code can access.
-Error ExampleJIT::addCallableFunctions(void) {
-    const DataLayout &DL = JIT->getDataLayout();
-    orc::SymbolMap syms;
-    orc::MangleAndInterner Mangle(JIT->getExecutionSession(), DL);
-    // Register every symbol that can be accessed from the JIT'ed code.
-    for (auto fa : CallableFuncs) {
-        syms[Mangle(fa.FName)] = 
-#if LLVM_VERSION_MAJOR >= 17  /* compiles, but not fully working yet */
-            orc::ExecutorSymbolDef(
-                orc::ExecutorAddr::fromPtr(fa.FAddr), JITSymbolFlags()
-            );
-#else
-            JITEvaluatedSymbol(
-                 pointerToJITTargetAddress(fa.FAddr), JITSymbolFlags()
-            );
-#endif
-    }
-
-    return JIT->getMainJITDylib().define(absoluteSymbols(syms));
-}
-
-// Parse this LLVM IR file into a Module
-std::unique_ptr<llvm::Module> ExampleJIT::addIR(const std::string &Filename)
-{
-    SMDiagnostic Smd;
-    auto M = parseIRFile(Filename, Smd, *Ctx);
-    if (!M) { // Get compile errors
-        std::string Err;
-        raw_string_ostream OS(Err);
-        Smd.print("lljit", OS);
-        ExitOnErr(createStringError(inconvertibleErrorCode(), Err.c_str()));
-    }
-    return M;
-}
-
-// Print this LLVM IR module's functions and blocks
-void printModule(const std::unique_ptr<llvm::Module> &M,const char *where)
-{
-    for (llvm::Function &F : *M)
-    {
-        errs()<<"define "<<F.getName()<<"() { ;  ("<<where<<")\n";
-        for (llvm::BasicBlock &B : F)
-        {
-            if (B.getName()!="") errs()<<"\n  "<<B.getName()<<": ";
-            for (llvm::BasicBlock *pre : predecessors(&B))
-                errs()<<"    ; Predecessor: %"<<pre->getName()<<"\n";
-            
-            for (llvm::Instruction &I : B)
-                errs()<<"    "<<I<<"\n";
-        }
-        errs()<<"}\n\n";
-    }
-}
-
-// Run optimization passes on this LLVM IR Module
-//  Source: https://llvm.org/docs/tutorial/BuildingAJIT2.html
-void ExampleJIT::optimize(const std::unique_ptr<llvm::Module> &M)
-{
-    auto FPM = std::make_unique<llvm::legacy::FunctionPassManager>(M.get());
-
-    // Add some optimizations.
-    FPM->add(createGVNPass());
-    FPM->add(createInstructionCombiningPass());
-    FPM->add(createCFGSimplificationPass());
-    FPM->add(createReassociatePass());
-    FPM->add(createLoopUnrollPass());
-    
-    
-    // FPM->add(new llvm::InlinerPass(false)); //   https://llvm.org/doxygen/classllvm_1_1InlinerPass.html
-    
-    
-    FPM->doInitialization();
-
-    // Run the optimizations over all functions in the module
-    const int nrepeat=3;
-    for (int repeat=0;repeat<nrepeat;repeat++) 
-        for (llvm::Function &F : *M)
-            FPM->run(F);
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "example_jit.h"
+
+// Call jitentry(0) through jitentry(n-1) with a batch loop, with arrays of
+//  T, and print the time per call.  Returns false if jitentry doesn't take T.
+template <typename T>
+bool time_batch(ExampleJIT &jit, long n, unsigned threads, void *mem) {
+    std::vector<T> in(n), out(n);
+    for (long i=0; i<n; i++) in[i] = i;
+
+    auto start = std::chrono::steady_clock::now();
+    if (!jit.batch("jitentry", in.data(), out.data(), n, threads, mem)) return false;
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+    long sum = 0;
+    for (T v : out) sum += v;
+    printf(" batch of %ld calls on %u threads: %.3f ns/call (sum %ld)\n",
+        n, threads, t*1.0e9/n, sum);
+    return true;
 }
 
-// Compile this LLVM IR file
-ExampleJIT::ExampleJIT(const std::string &Filename) 
-    :OK(false)
-{
-    InitializeNativeTarget();
-    InitializeNativeTargetAsmPrinter();
-
-    // Create LLVM context
-    Ctx = std::make_unique<LLVMContext>();
-
-    // Create an LLJIT instance
-    auto J = orc::LLJITBuilder().create();
-    if (!J) {
-        ExitOnErr(std::move(J));
-        return;
-    }
-    JIT = std::move(*J);
-
-    if (addCallableFunctions()) {
-        return;
-    }
-
-    // Parse IR into a Module
-    std::unique_ptr<llvm::Module> M = addIR(Filename);
-    if (!M) {
-        return;
-    }
-    
-    printModule(M,"before optimization");
-    
-    // Optimization passes
-    optimize(M);
-    
-    printModule(M,"after optimization");
-
-    // Add the Module to our JIT
-    orc::ThreadSafeModule TSM(std::move(M), std::move(Ctx));
-    if (auto Err = JIT->addIRModule(std::move(TSM))) {
-        ExitOnErr( std::move(Err) );
-        return;
-    }
-
-    OK = true;
-}
-
-// Return the in-memory address of this symbol
-void * ExampleJIT::lookup(const std::string &Symbol) {
-    auto SA = JIT->lookup(Symbol);
-    if (SA.takeError()) {
-        return 0;
+int main(int argc, char *argv[]) {
+    const char *filename = "in.ll";
+    const char *cachedir = 0;
+    bool lazy = false; // compile everything, so we can show the machine code
+    bool timepasses = false;
+    bool perf = false;
+    bool watch = false; // hot-reload the file, and keep running it
+    long batch = 0; // number of calls to make in the batch test
+    long profile = 0; // calls before profile-guided recompile
+    const char *optlevel = "O2";
+    bool vectorize = true;
+    const char *cpu = "host";
+    const char *features = "";
+    const char *runtime = "runtime.bc"; // inlinable runtime functions
+    for (int argi=1; argi<argc; argi++) {
+        if (0==strcmp(argv[argi],"-cache") && argi+1<argc) cachedir = argv[++argi];
+        else if (0==strcmp(argv[argi],"-lazy")) lazy = true;
+        else if (0==strcmp(argv[argi],"-time-passes")) timepasses = true;
+        else if (0==strcmp(argv[argi],"-perf")) perf = true;
+        else if (0==strcmp(argv[argi],"-watch")) watch = true;
+        else if (0==strcmp(argv[argi],"-runtime") && argi+1<argc) runtime = argv[++argi];
+        else if (0==strcmp(argv[argi],"-batch") && argi+1<argc) batch = atol(argv[++argi]);
+        else if (0==strcmp(argv[argi],"-profile") && argi+1<argc) profile = atol(argv[++argi]);
+        else if (0==strcmp(argv[argi],"-novec")) vectorize = false;
+        else if (0==strncmp(argv[argi],"-mcpu=",6)) cpu = argv[argi]+6;
+        else if (0==strncmp(argv[argi],"-mattr=",7)) features = argv[argi]+7;
+        else if (argv[argi][0]=='-' && argv[argi][1]=='O') optlevel = argv[argi]+1;
+        else filename = argv[argi];
     }
 
-#if LLVM_VERSION_MAJOR >= 15
-    return reinterpret_cast<void *>((*SA).getValue());
-#else
-    return reinterpret_cast<void *>((*SA).getAddress());
-#endif
-}
-
-
-int main(int argc, char *argv[]) {
     // Compile the LLVM IR input
-    ExampleJIT jit("in.ll");
-    if (!jit) {
+    ExampleJIT jit;
+    jit.setVerbose(true);
+    jit.setLazy(lazy);
+    jit.setTimePasses(timepasses);
+    if (!jit.setOptLevel(optlevel)) return 1;
+    jit.setVectorize(vectorize);
+    jit.setTarget(cpu, features);
+    if (perf && !jit.enablePerf()) printf("This LLVM doesn't support perf\n");
+    if (cachedir && !jit.setCacheDir(cachedir)) return 1;
+    if (strcmp(runtime,"none")!=0 && access(runtime,R_OK)==0 && !jit.setRuntime(runtime)) return 1;
+    if (batch) jit.addBatchWrapper("jitentry");
+    jit.setProfiling(profile);
+    if (!jit || !(watch ? jit.watchFile(filename) : jit.addFile(filename))) {
         printf("Error setting up LLVM JIT\n");
         return 1;
     }
 
     // Look up the code entry point
-    typedef long (*function_ptr)(long arg0);
-    function_ptr run = reinterpret_cast<function_ptr>(
-        jit.lookup("jitentry")
-    );
+    auto run = jit.get<long(long arg0,void *mem)>("jitentry");
+    if (!run) {
+        printf("No jitentry function found\n");
+        return 1;
+    }
+
+    // Translated RevRISC code says how much memory it needs
+    //   (other code just ignores the mem argument)
+    void *mem = 0;
+    const int *memsize = jit.get<const int>("jitmemsize");
+    if (memsize) mem = calloc(*memsize, sizeof(int));
 
     // Print some machine code at that entry point
+    //  (in lazy mode, this is the stub that compiles it)
     print_hex((void *)run,32);
 
     // Run the code
-    long result = run(6);
+    auto start = std::chrono::steady_clock::now();
+    long result = run(6, mem);
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
 
     // Show the returned value
-    printf(" result %ld (%08lx)\n", result, result);
+    printf(" result %ld (%08lx) in %.3f ms\n", result, result, t*1.0e3);
+
+    if (batch) { // Run jitentry(0) through jitentry(batch-1)
+        // Code that uses memory can't share it between threads
+        unsigned threads = mem ? 1 : std::thread::hardware_concurrency();
+        // Translated machine code takes and returns 32-bit registers
+        bool narrow = jit.batchType("jitentry")=="i32(i32,ptr)";
+
+        // With profiling, the second pass should run the recompiled code
+        for (int pass=0; pass<(profile ? 2 : 1); pass++)
+            if (!(narrow ? time_batch<int>(jit, batch, threads, mem)
+                         : time_batch<long>(jit, batch, threads, mem))) break;
+        if (profile) printf(" %d modules recompiled with profiles\n", jit.getTierUps());
+    }
+    free(mem);
+
+    while (watch) { // Run the newest version of the file every second
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        ExampleJIT::CodeGuard guard(jit); // keeps this version's code around
+        memsize = jit.get<const int>("jitmemsize");
+        mem = memsize ? calloc(*memsize, sizeof(int)) : 0;
+        result = run(6, mem);
+        free(mem);
+        printf(" result %ld (%d reloads)\n", result, jit.getReloads());
+        fflush(stdout);
+    }
+
+    ExampleJIT::PhaseTimes phases = jit.getPhaseTimes();
+    printf(" parse %.3f ms, optimize %.3f ms, codegen %.3f ms, link %.3f ms\n",
+        phases.Parse*1.0e3, phases.Optimize*1.0e3, phases.Codegen*1.0e3, phases.Link*1.0e3);
+    for (const ExampleJIT::ModuleMemory &m : jit.getModuleMemory())
+        printf(" %s: %zu bytes of code, %zu bytes of data\n", m.Name.c_str(), m.Code, m.Data);
     return EXIT_SUCCESS;
 }
 
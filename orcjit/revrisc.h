@@ -0,0 +1,1460 @@
+/*
+  Translates RevRISC machine code to LLVM IR, with the goal of understanding
+  what the LLVM optimizers can do with complex programs.
+  
+  Uses alloca to simulate modifiable registers.
+  Uses a "jump table" to support arbitrary register F jumps.
+  
+  This version 0.2 supports function calls (via 0xC), 
+  a variety of arithmetic instructions: 0xA add, 0x8 mul, 0x7 div, 0xB sub,
+  and mem/stack ops (0xE), including push (0xE1) and pop (0xED).
+  
+  Memory is a mem_t* argument passed to jitentry.  A simple range analysis
+  finds the possible values of each register, so memory accesses that are
+  provably in bounds skip the runtime bounds check (or all of them do, with
+  guard_pages, when the code runs on our guarded memory), and jumps to a known
+  target become direct branches.  A liveness analysis skips stores to
+  registers that are never read, and registers keep their values in LLVM
+  variables along straight-line code, so LLVM has less IR to optimize.
+  
+  Big programs are split into regions, each its own LLVM function, grown
+  from the start, each called function, and each indirect jump target.
+  A dispatcher calls the region for the current PC.  Only real indirect 
+  jump targets and region entries go in the jump tables.
+  
+  The same class is also a fast interpreter for RevRISC (see run), 
+  which counts the jumps to each target so hot code can be compiled.
+  
+  Dr. Orion Lawlor and the CS 601 class, 2024-02 (Public Domain)
+*/
+#ifndef REVRISC_H
+#define REVRISC_H
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <set>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+typedef int32_t reg_t; // data in our registers
+typedef uint32_t inst_t; // one machine code instruction
+typedef reg_t mem_t; // data in memory
+
+/* Machine memory that costs nothing until it's touched, surrounded by
+  guard pages.  mmap hands out zero pages on first touch, so a big
+  machine with a small program only pays for the pages it uses.
+  
+  The guard pages cover every index a 32-bit reg_t can hold, 8 GB of
+  address space (but no actual memory) on each side, so any access 
+  outside [0,words) faults.  The SIGSEGV handler reports faults in
+  guarded memory through the owner's on_fault, and passes other
+  crashes on to the handler that was there before (like LLVM's).
+*/
+class guarded_memory {
+public:
+	typedef void (*fault_fn)(void *owner,long index);
+	
+	mem_t *data; // data[0] through data[words-1] are usable
+	
+	guarded_memory(long words,fault_fn on_fault,void *owner)
+	{
+		const size_t guard = sizeof(mem_t)<<31; // reg_t index range, each way
+		size_t page = 4096;
+		usable = (words*sizeof(mem_t) + page-1) & ~(page-1);
+		total = guard + usable + guard;
+		base = (char *)mmap(0, total, PROT_NONE, 
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+		if (base==(char *)MAP_FAILED || 
+			mprotect(base+guard, usable, PROT_READ|PROT_WRITE)!=0) 
+		{
+			printf("Fatal error: can't map %ld words of guarded memory\n",words);
+			exit(1);
+		}
+		data = (mem_t *)(base+guard);
+		
+		slot *s = find_slot(0);
+		if (!s) { printf("Fatal error: too many guarded memories\n"); exit(1); }
+		s->data = data; s->lo = base; s->hi = base+total; s->on_fault = on_fault;
+		s->owner.store(owner, std::memory_order_release);
+		install_handler();
+	}
+	~guarded_memory() {
+		slot *s = find_slot(data);
+		if (s) s->owner.store(0, std::memory_order_release);
+		munmap(base, total);
+	}
+	guarded_memory(const guarded_memory &) = delete;
+	void operator=(const guarded_memory &) = delete;
+	
+private:
+	char *base; // start of the whole mapping, including guards
+	size_t usable, total; // bytes
+	
+	// Every live guarded_memory, so the signal handler can find it
+	struct slot {
+		std::atomic<void *> owner{0}; // 0 if the slot is free
+		mem_t *data; char *lo, *hi;
+		fault_fn on_fault;
+	};
+	enum { max_slots=64 };
+	static slot *slots() { static slot s[max_slots]; return s; }
+	
+	// Return the slot for this data, or a free slot if data is 0
+	static slot *find_slot(mem_t *data) {
+		for (int i=0;i<max_slots;i++) {
+			slot &s = slots()[i];
+			if (data) {
+				if (s.owner.load() && s.data==data) return &s;
+			}
+			else {
+				void *free_owner = 0;
+				if (s.owner.compare_exchange_strong(free_owner, (void *)&s)) return &s; // claimed
+			}
+		}
+		return 0;
+	}
+	
+	static void handle_fault(int sig,siginfo_t *info,void *context) {
+		char *addr = (char *)info->si_addr;
+		for (int i=0;i<max_slots;i++) {
+			slot &s = slots()[i];
+			void *owner = s.owner.load(std::memory_order_acquire);
+			if (owner && owner!=(void *)&s && addr>=s.lo && addr<s.hi) {
+				long index = (addr - (char *)s.data)/(long)sizeof(mem_t);
+				s.on_fault(owner, index); // doesn't return
+			}
+		}
+		
+		// Not ours: chain to the old handler, or crash normally when it re-faults
+		struct sigaction &old = old_action();
+		if (old.sa_flags & SA_SIGINFO) old.sa_sigaction(sig, info, context);
+		else if (old.sa_handler!=SIG_DFL && old.sa_handler!=SIG_IGN) old.sa_handler(sig);
+		else sigaction(SIGSEGV, &old, 0);
+	}
+	static struct sigaction &old_action() { static struct sigaction a; return a; }
+	static void install_handler() {
+		static std::atomic<bool> installed{false};
+		if (installed.exchange(true)) return;
+		struct sigaction sa = {};
+		sa.sa_sigaction = handle_fault;
+		sa.sa_flags = SA_SIGINFO;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGSEGV, &sa, &old_action());
+	}
+};
+
+/* Passes LLVM IR text through to another stream, adding a debug location
+  (like ", !dbg !12") to each instruction: lines that start with two
+  spaces, before any comment.  Labels, comments, and everything outside
+  functions pass through unchanged.
+*/
+class debug_location_filter : public std::streambuf {
+public:
+	std::ostream *dest=0;
+	std::string location; // added to each instruction, or "" for none
+	
+	void flush_line() {
+		if (location!="" && line.size()>2 && line.compare(0,2,"  ")==0 
+			&& line[2]!=' ' && line[2]!=';') 
+		{
+			size_t end = line.find(';');
+			if (end==std::string::npos) end = line.find('\n');
+			if (end==std::string::npos) end = line.size();
+			line.insert(end, location);
+		}
+		*dest<<line;
+		line.clear();
+	}
+protected:
+	int overflow(int c) override {
+		if (c==EOF) return 0;
+		line += (char)c;
+		if (c=='\n') flush_line();
+		return c;
+	}
+private:
+	std::string line; // the line so far
+};
+
+// Decoded bits of one machine code instruction
+// 0x O O R R R C C C
+struct decoded_t {
+	inst_t inst; // the raw machine code
+	inst_t opG; // opcode group
+	inst_t opL; // low opcode
+	inst_t rD; // destination
+	inst_t rX;
+	inst_t rY;
+	reg_t c;
+	
+	decoded_t(inst_t inst_) :inst(inst_) {
+		opG = 0xF & (inst >> 28);
+		opL = 0xF & (inst >> 24);
+		rD = 0xF & (inst >> 20);
+		rX = 0xF & (inst >> 16);
+		rY = 0xF & (inst >> 12);
+		c = 0xFFF & (inst >> 0);
+		
+		// sign-extend c from 12 bits to 32 bits
+		//  c = 0x00000CCC <- loaded from instruction
+		//  c = 0xfffffCCC  (if negative, sign extended)
+		//if (c & 0x800) c = c|0xFFFFF000; // manual, find sign bit and extend
+		c = (c<<20)>>20; // use hardware sign-extend
+	}
+};
+
+// The range of values a register might hold at one point in the program,
+//  as an inclusive interval.  Bounds are 64-bit so we can see 32-bit wraparound.
+struct reg_range {
+	long lo, hi;
+	
+	reg_range(long lo_=INT32_MIN, long hi_=INT32_MAX) :lo(lo_), hi(hi_) {}
+	static reg_range constant(long v) { return reg_range(v,v); }
+	
+	bool operator==(const reg_range &o) const { return lo==o.lo && hi==o.hi; }
+	
+	// If the arithmetic might have wrapped around, we know nothing.
+	reg_range wrap() const {
+		if (lo<INT32_MIN || hi>INT32_MAX) return reg_range();
+		return *this;
+	}
+	
+	// Smallest range containing both ranges
+	reg_range join(const reg_range &o) const {
+		return reg_range(std::min(lo,o.lo), std::max(hi,o.hi));
+	}
+	
+	// Widening: a bound that is still moving jumps straight to the limit,
+	//  so loops like "r5++" converge in a few passes.
+	reg_range widen(const reg_range &next) const {
+		return reg_range(next.lo<lo?INT32_MIN:lo, next.hi>hi?INT32_MAX:hi);
+	}
+	
+	reg_range operator+(const reg_range &o) const {
+		return reg_range(lo+o.lo, hi+o.hi).wrap();
+	}
+	reg_range operator-(const reg_range &o) const {
+		return reg_range(lo-o.hi, hi-o.lo).wrap();
+	}
+	reg_range operator*(const reg_range &o) const {
+		if (lo<INT32_MIN || hi>INT32_MAX || o.lo<INT32_MIN || o.hi>INT32_MAX)
+			return reg_range(); // products could overflow even 64 bits
+		long p[4]={lo*o.lo, lo*o.hi, hi*o.lo, hi*o.hi};
+		return reg_range(*std::min_element(p,p+4), *std::max_element(p,p+4)).wrap();
+	}
+	// Remainder has the sign of the dividend, and is smaller than the divisor
+	reg_range operator%(const reg_range &o) const {
+		if (o.lo<=0 && o.hi>=0) return reg_range(); // might divide by zero
+		long d = std::max(std::abs(o.lo), std::abs(o.hi)) - 1;
+		return reg_range(lo>=0?0:-d, hi<=0?0:d);
+	}
+};
+
+// Register ranges at one point in the program
+struct range_state {
+	bool reached=false; // false if no path has gotten here (yet)
+	reg_range r[16];
+};
+
+template <const int memsize, const int stacksize=16>
+class RevRISC_interpreter {
+public:
+	// Normal user-visible registers
+	enum {
+		reg_stack = 0xA, // stack pointer register
+		reg_pc = 0xF, // program counter / instruction pointer register
+	};
+	reg_t regs[16]={0}; 
+
+	// System registers, for an OS and hypervisor
+	enum {
+		sysreg_heapstart = 0  // Address of beginning of read-write memory area
+	};
+	reg_t sysregs[16]={0}; 
+	
+	// RAM memory: instructions, heap, and the stack.  Pages get mapped
+	//   when they're first touched, and bad addresses fault into fatal.
+	//   It's reserved by load, so a machine that only translates doesn't
+	//   tie up 16 GB of address space for the guard pages.
+	std::unique_ptr<guarded_memory> memory;
+	mem_t *mem = 0;
+	
+	// If true, the translated code leaves out bounds checks, so it must
+	//   run on our guarded memory (like revrisc_tiered does).
+	bool guard_pages=false;
+	
+	// Translated LLVM IR goes here
+	std::ostream *out = &std::cout;
+	std::ostream &emit() { return *out; }
+
+	// Debug info: with debug_info set, each instruction of the translated 
+	//   code carries a DILocation whose line is its RevRISC pc+1, in
+	//   debug_file (see write_listing), so gdb and perf can map native
+	//   code back to the RevRISC instruction it came from.
+	bool debug_info=false;
+	std::string debug_file="revrisc.lst"; // one line per instruction
+	debug_location_filter debug_filter; // adds the locations
+	std::ostream debug_out{&debug_filter};
+	std::ostream *debug_old_out=0; // where the module goes, under the filter
+	std::vector<std::string> debug_nodes; // metadata for this module, from !5 on
+	std::string debug_scope; // DISubprogram of the function we're in
+	
+	// Add this metadata node to the module, and return its name
+	std::string debug_node(const std::string &node) {
+		debug_nodes.push_back(node);
+		return "!"+std::to_string(4+debug_nodes.size());
+	}
+	
+	// Start a module: route its text through the filter
+	void begin_module() {
+		if (!debug_info) return;
+		debug_nodes.clear();
+		debug_filter.dest = out;
+		debug_filter.location = "";
+		debug_old_out = out;
+		out = &debug_out;
+	}
+	
+	// Start a function, debugged as starting at this pc.
+	//   Returns the attachment that goes after its signature.
+	std::string debug_function(const std::string &name,reg_t pc) {
+		if (!debug_info) return "";
+		std::string line = std::to_string(pc+1);
+		debug_scope = debug_node("distinct !DISubprogram(name: \""+name+"\", scope: !1, file: !1,"
+			" line: "+line+", type: !2, scopeLine: "+line+", spFlags: DISPFlagDefinition, unit: !0)");
+		debug_at(pc);
+		return " !dbg "+debug_scope;
+	}
+	
+	// The instructions emitted from now on came from the RevRISC instruction at pc
+	void debug_at(reg_t pc) {
+		if (!debug_info) return;
+		debug_filter.location = ", !dbg "+debug_node("!DILocation(line: "
+			+std::to_string(pc+1)+", scope: "+debug_scope+")");
+	}
+	
+	// Finish a module: add its metadata
+	void end_module() {
+		if (!debug_info) return;
+		debug_filter.location = "";
+		out = debug_old_out;
+		emit()<<"\n!llvm.dbg.cu = !{!0}\n";
+		emit()<<"!llvm.module.flags = !{!3, !4}\n";
+		emit()<<"!0 = distinct !DICompileUnit(language: DW_LANG_C, file: !1, producer: \"revrisc.h\","
+			" isOptimized: false, runtimeVersion: 0, emissionKind: LineTablesOnly)\n";
+		emit()<<"!1 = !DIFile(filename: \""+debug_file+"\", directory: \".\")\n";
+		emit()<<"!2 = !DISubroutineType(types: !{})\n";
+		emit()<<"!3 = !{i32 2, !\"Debug Info Version\", i32 3}\n";
+		emit()<<"!4 = !{i32 2, !\"Dwarf Version\", i32 4}\n";
+		for (size_t n=0;n<debug_nodes.size();n++)
+			emit()<<"!"<<5+n<<" = "<<debug_nodes[n]<<"\n";
+	}
+
+	void fatal(inst_t inst,const char *why) {
+		printf("Fatal error: %s (inst %08x at addr %08x)\n",
+			why,inst,regs[0xF]);
+		exit(1);
+	}
+	
+	// Called from the SIGSEGV handler for an access to mem[index].
+	//   (printf isn't safe in a signal handler, but we're exiting anyway.)
+	static void bad_address(void *owner,long index) {
+		((RevRISC_interpreter *)owner)->fatal(0,"Bad mem addr");
+	}
+	
+	// Convert this number to a hex string.
+	std::string hex(unsigned long r,int digits=1) {
+		std::string ret="";
+		// Extract the highest digit first
+		for (int digit=digits-1;digit>=0;digit--)
+		{
+			int place = 0xF & (r >> (4*digit));
+			char c = "0123456789ABCDEF"[place]; // index out hex digit
+			ret += c;
+		}
+		return ret;
+	}
+	
+	// Convert this program counter value to a hex string
+	int pc_digits=2; // enough hex digits for every pc in the program
+	std::string hex_pc(unsigned long pc) {
+		return hex(pc,pc_digits); //<- defines policy on number of hex digits for jump labels
+	}
+	
+	// Return the jump label for this pc value
+	std::string label_pc(unsigned long pc) {
+		return "j"+hex_pc(pc);
+	}
+	
+	// Return the label to branch to for this pc value, from inside this
+	//   region.  Jumps leaving the region go through an "out" stub.
+	int cur_region=0; // region we're translating
+	std::vector<reg_t> out_stubs; // pcs outside this region that we jump to
+	std::string branch_label(reg_t pc) {
+		if (pc<0 || pc>=(reg_t)region_of.size()) return "exit"; // off the program
+		if (region_of[pc]==cur_region) return label_pc(pc);
+		if (std::find(out_stubs.begin(),out_stubs.end(),pc)==out_stubs.end())
+			out_stubs.push_back(pc);
+		return "out"+hex_pc(pc);
+	}
+	
+	// Emit the start of this instruction.  
+	//  Returns an ID used for temporaries.
+	std::string start_inst() {
+		unsigned long this_pc = regs[reg_pc]-1; // our own address
+		emit()<<label_pc(this_pc)+":\n";
+		return hex_pc(this_pc);
+	}
+	
+	// Return the LLVM variable that stores this register's address
+	std::string reg_addr(int rN) {
+		return "%r"+hex(rN,1)+"addr";
+	}
+	
+	// Get this RevRISC register's value, returning the LLVM value to use:
+	//   a constant if we know it, the LLVM variable it's already in,
+	//   or else a new load into this LLVM variable.
+	std::string load_reg(int rN,const std::string &varname) {
+		if (rN==0) return "0"; // special case: zero
+		if (rN==0xF) return std::to_string(regs[reg_pc]); // we know the PC addr at compile time
+		if (preoptimize) {
+			if (reg_value[rN]!="") return reg_value[rN]; // loaded or stored earlier
+			reg_range r = ranges_in[regs[reg_pc]-1].r[rN];
+			if (r.lo==r.hi) return std::to_string(r.lo); // range analysis knows the value
+		}
+		// normal register, load from memory
+		emit()<<"  "+varname+" = load i32, i32 * "+reg_addr(rN)+", align 4\n";
+		if (preoptimize) reg_value[rN]=varname;
+		return varname;
+	}
+	
+	// Store this LLVM value into this RevRISC register.
+	//   Returns true if the store is normal and needs a normal jump afterwards.
+	bool store_reg(int rN,const std::string &varname) {
+		if (rN==0) return true; // writes to the zero register are discarded
+		if (preoptimize && rN!=0xF) { // store it later, if anybody reads it
+			reg_value[rN]=varname;
+			dirty |= 1<<rN;
+			return true;
+		}
+		flush_regs();
+		emit()<<"  store i32 "+varname+", i32 * "+reg_addr(rN)+", align 4\n";
+		
+		if (rN==0xF)
+		{ // write to PC, so we need a jump
+			unsigned long this_pc = regs[reg_pc]-1;
+			if (known_jump(this_pc)) // range analysis knows where we're going
+				emit()<<"  br label %"+branch_label(jump_ranges[this_pc].lo)+"\n";
+			else { // indirect jump
+				emit_inline_cache(this_pc,varname);
+				emit()<<"  br label %rFjump\n";
+				jumps_indirect=true;
+			}
+			return false;
+		}
+		return true;
+	}
+	
+	// Inline caches: before an indirect jump goes through the rFjump table,
+	//   compare its target against the targets it's likely to hit, and
+	//   branch straight there, or for a target in another region, call
+	//   that region directly instead of returning to the dispatcher.
+	//   Likely targets are the last target the interpreter saw this jump
+	//   go to (see jump_last), and every target the range analysis allows,
+	//   if there are only a few (like the return addresses of a function
+	//   called from a few places).
+	int inline_cache_size=4; // most targets to compare against, 0 for none
+	std::vector<reg_t> target_list; // pcs with is_target set, in order
+	std::vector<reg_t> chain_stubs; // targets in other regions we call directly
+	bool separate_modules=false; // each region is its own module
+	
+	// Can an inline cache branch straight to target t?  Only real targets:
+	//   other pcs assume we didn't get there by jumping.  In one module,
+	//   only targets in this region: calling another region directly would
+	//   stop LLVM inlining the regions into the dispatcher, which is faster.
+	bool cacheable(reg_t t) {
+		if (t<0 || t>=(reg_t)is_target.size() || !is_target[t]) return false;
+		if (separate_modules) return region_of[t]!=-1;
+		return region_of[t]==cur_region;
+	}
+	
+	// Return the targets worth comparing against for the jump at pc
+	std::vector<reg_t> cached_targets(unsigned long pc) {
+		std::vector<reg_t> cached;
+		if (pc<jump_last.size() && cacheable(jump_last[pc]))
+			cached.push_back(jump_last[pc]);
+		
+		auto lo = std::lower_bound(target_list.begin(),target_list.end(),jump_ranges[pc].lo);
+		auto hi = std::upper_bound(target_list.begin(),target_list.end(),jump_ranges[pc].hi);
+		if (hi-lo <= inline_cache_size)
+			for (auto t=lo; t!=hi; ++t)
+				if (cacheable(*t) && std::find(cached.begin(),cached.end(),*t)==cached.end())
+					cached.push_back(*t);
+		if ((int)cached.size() > inline_cache_size) cached.resize(inline_cache_size);
+		return cached;
+	}
+	
+	// Emit the inline cache for the indirect jump at pc to this target,
+	//   falling through to the code after it on a miss.
+	void emit_inline_cache(unsigned long pc,const std::string &target) {
+		std::vector<reg_t> cached = cached_targets(pc);
+		for (size_t k=0;k<cached.size();k++) {
+			reg_t t = cached[k];
+			std::string label = label_pc(t);
+			if (region_of[t]!=cur_region) {
+				label = "chain"+hex_pc(t);
+				if (std::find(chain_stubs.begin(),chain_stubs.end(),t)==chain_stubs.end())
+					chain_stubs.push_back(t);
+			}
+			std::string id = hex_pc(pc)+"_"+std::to_string(k);
+			emit()<<"  %I"+id+" = icmp eq i32 "+target+", "<<t<<"\n";
+			emit()<<"  br i1 %I"+id+", label %"+label+", label %miss"+id+"\n";
+			emit()<<" miss"+id+":\n";
+		}
+	}
+	
+	// Store the registers we've changed but not stored yet, if they're
+	//   live after this instruction.  Call before branching anywhere but
+	//   straight-line code.
+	void flush_regs() {
+		uint16_t live = dirty & live_out[regs[reg_pc]-1];
+		for (int r=1;r<0xF;r++)
+			if (live & (1<<r))
+				emit()<<"  store i32 "+reg_value[r]+", i32 * "+reg_addr(r)+", align 4\n";
+		dirty=0;
+	}
+	
+	// Finish this instruction, with a jump to the next instruction.
+	void end_inst() {
+		reg_t next = regs[reg_pc];
+		if (!(preoptimize && next<(reg_t)straight.size() && straight[next])) 
+			flush_regs(); // else the next instruction keeps our values
+		emit()<<"  br label %"+branch_label(next)+"\n"; 
+	}
+	
+	// Emit a complete arithmetic instruction sequence
+	void emit_arith(const std::string &op, int rD, int rX, int rY, int c)
+	{
+		std::string id = start_inst();
+		if (rD==0xF && rX==0 && rY==0) { // special case: jump to a constant
+		    flush_regs();
+		    emit()<<"  br label %"+branch_label(c)+"\n";
+		}
+		else if (preoptimize && rD!=0xF && !(live_out[regs[reg_pc]-1] & (1<<rD))) {
+		    emit()<<"  ; result is never read\n";
+		    end_inst();
+		}
+		else { // General case
+		    std::string X = load_reg(rX,"%X"+id);
+		    std::string Y = load_reg(rY,"%Y"+id);
+		    
+		    emit()<<"  %C"+id+" = add i32 "+Y+", "<<c<<"\n";
+		    emit()<<"  %D"+id+" = "+op+" i32 "+X+", %C"+id+"\n";
+		    if (store_reg(rD,"%D"+id))
+			    end_inst();
+		}
+    }
+    // Emit a conditional swap
+    void emit_cswap(const std::string &cmp, int rD, int rX, int rY, int c)
+    {
+	// if (regs[rX] < ( regs[rY] + c ))
+		std::string id = start_inst();
+		std::string X = load_reg(rX,"%X"+id);
+		std::string Y = load_reg(rY,"%Y"+id);
+		
+		emit()<<"  %C"+id+" = add i32 "+Y+", "<<c<<"\n";
+		emit()<<"  %S"+id+" = "+cmp+" i32 "+X+", %C"+id+"\n";
+		flush_regs(); // both paths leave straight-line code
+		emit()<<"  br i1 %S"+id+", label %swap"+id+", label %"+branch_label(regs[reg_pc])+"\n";
+		
+	// std::swap(regs[rD],regs[rD-1]), behind a label
+		emit()<<" swap"+id+":\n";
+		int rE = 0xF & (rD-1);
+		std::string D = load_reg(rD,"%D"+id);
+		std::string E = load_reg(rE,"%E"+id);
+		// do stores in opposite order for swap (swapping r0 with rF jumps)
+		bool normal = store_reg(rE,D);
+		if (store_reg(rD,E) && normal) 
+			end_inst();
+    }
+    
+    // Emit a memory access: swap(regs[rD], mem[regs[rX] + regs[rY] + c])
+    //   opL 0x1 pre-increments rX (push), opL 0xD post-decrements rX (pop).
+    void emit_mem(int opL, int rD, int rX, int rY, int c)
+    {
+		unsigned long this_pc = regs[reg_pc]-1;
+		std::string id = start_inst();
+		if (opL==0x1) { // pre-increment (push, ++pointer)
+			std::string P = load_reg(rX,"%P"+id);
+			emit()<<"  %Q"+id+" = add i32 "+P+", 1\n";
+			store_reg(rX,"%Q"+id);
+		}
+		std::string X = load_reg(rX,"%X"+id);
+		std::string Y = load_reg(rY,"%Y"+id);
+		emit()<<"  %C"+id+" = add i32 "+Y+", "<<c<<"\n";
+		emit()<<"  %A"+id+" = add i32 "+X+", %C"+id+"\n";
+		
+		reg_range addr = mem_ranges[this_pc];
+		if (guard_pages) { // bad addresses fault
+			emit()<<"  ; guard pages check bounds\n";
+		}
+		else if (addr.lo>=0 && addr.hi<memsize) { // range analysis says it's safe
+			emit()<<"  ; address always in ["<<addr.lo<<","<<addr.hi<<"], no bounds check\n";
+		}
+		else { // if (addr<0 || addr>=memsize) fatal: unsigned compare checks both
+			emit()<<"  %B"+id+" = icmp uge i32 %A"+id+", "<<memsize<<"\n";
+			emit()<<"  br i1 %B"+id+", label %exit, label %mem"+id+"\n";
+			emit()<<" mem"+id+":\n";
+		}
+		
+		// std::swap(regs[rD],mem[ addr ])
+		emit()<<"  %M"+id+" = getelementptr i32, i32 * %mem, i32 %A"+id+"\n";
+		emit()<<"  %V"+id+" = load i32, i32 * %M"+id+", align 4\n";
+		std::string D = load_reg(rD,"%D"+id);
+		emit()<<"  store i32 "+D+", i32 * %M"+id+", align 4\n";
+		
+		// Post-decrement happens after the swap, but before any jump to rF
+		if (opL==0xD && rD!=rX) emit_decrement(rX,id);
+		bool normal = store_reg(rD,"%V"+id);
+		if (opL==0xD && rD==rX) emit_decrement(rX,id);
+		if (normal)
+			end_inst();
+    }
+    
+    // Emit regs[rX]-- (pop, pointer--)
+    void emit_decrement(int rX, const std::string &id)
+    {
+		std::string R = load_reg(rX,"%R"+id);
+		emit()<<"  %S"+id+" = add i32 "+R+", -1\n";
+		store_reg(rX,"%S"+id);
+    }
+    
+    
+	// Results of range analysis, indexed by pc
+	std::vector<range_state> ranges_in; // register ranges before each instruction
+	std::vector<reg_range> mem_ranges; // address range for each memory access
+	std::vector<reg_range> jump_ranges; // new PC for each write to rF
+	std::vector<char> is_call; // 1 for an unconditional swap with the PC
+	std::vector<char> addr_taken; // 1 if a register might hold this pc as a constant
+	std::vector<char> is_target; // 1 if an indirect jump might land here
+	std::vector<int> target_cover; // +1 where a jump's range starts, -1 past its end
+	std::vector<int> merges; // number of times each pc's state has grown
+	enum { widen_after=4 }; // merges before we start widening ranges
+	bool all_targets=false; // if true, put every pc in the indirect jump table
+	
+	// Merge this state into the state before instruction pc.
+	//   Returns true if pc's state grew, so we need another pass.
+	bool merge_range(unsigned long pc,const range_state &s) {
+		if (pc>=ranges_in.size()) return false; // jump out of the program
+		range_state &old = ranges_in[pc];
+		if (!old.reached) { old=s; return true; }
+		
+		bool changed=false;
+		for (int r=0;r<16;r++) {
+			reg_range j = old.r[r].join(s.r[r]);
+			if (!(j==old.r[r])) {
+				if (merges[pc]++ > widen_after) j = old.r[r].widen(j);
+				old.r[r]=j;
+				changed=true;
+			}
+		}
+		return changed;
+	}
+	
+	// Return the range of this register, read by the instruction at pc
+	reg_range read_range(const range_state &s,int rN,unsigned long pc) {
+		if (rN==0) return reg_range::constant(0);
+		if (rN==0xF) return reg_range::constant(pc+1); // PC has moved on
+		return s.r[rN];
+	}
+	
+	// Return true if the write to rF at this pc always goes to the same place
+	bool known_jump(unsigned long pc) {
+		return jump_ranges[pc].lo==jump_ranges[pc].hi;
+	}
+	
+	// Push state s through the instruction at pc, merging the result into
+	//   the following instructions, or into "jumped" for indirect jumps.
+	bool step_range(unsigned long pc,inst_t inst,range_state s,range_state &jumped) {
+		decoded_t d(inst);
+		bool changed=false;
+		bool jump=false; // set if we write rF
+		
+		switch(d.opG) {
+		case 0x7: case 0x8: case 0xA: case 0xB: { // arithmetic
+			if (d.rD==0xF && d.rX==0 && d.rY==0) { // jump to a constant
+				jump_ranges[pc] = reg_range::constant(d.c);
+				return merge_range(d.c,s);
+			}
+			reg_range x = read_range(s,d.rX,pc);
+			reg_range y = read_range(s,d.rY,pc) + reg_range::constant(d.c);
+			reg_range v;
+			if (d.opG==0x8) v = x*y;
+			else if (d.opG==0xA) v = x+y;
+			else if (d.opG==0xB) v = x-y;
+			else if (d.opL==0x1) v = x%y;
+			// else divide: anything
+			s.r[d.rD] = v;
+			jump = (d.rD==0xF);
+			break;
+		}
+		case 0xC: { // conditional swap: the no-swap path goes to the next instruction
+			changed |= merge_range(pc+1,s);
+			int rE = 0xF & (d.rD-1);
+			reg_range X = read_range(s,d.rX,pc);
+			reg_range C = read_range(s,d.rY,pc) + reg_range::constant(d.c);
+			reg_range D = read_range(s,d.rD,pc), E = read_range(s,rE,pc);
+			s.r[d.rD] = E;
+			s.r[rE] = D;
+			jump = (d.rD==0xF || rE==0xF);
+			is_call[pc] = jump && X.hi < C.lo; // always swaps the PC
+			break;
+		}
+		case 0xE: { // memory access
+			if (d.opL==0x1) s.r[d.rX] = read_range(s,d.rX,pc) + reg_range::constant(1);
+			mem_ranges[pc] = read_range(s,d.rX,pc) + read_range(s,d.rY,pc)
+				+ reg_range::constant(d.c);
+			s.r[d.rD] = reg_range(); // loaded from memory: could be anything
+			if (d.rD==0xF && pc+1<addr_taken.size()) // call or return through memory
+				addr_taken[pc+1]=1; // saves the return address pc+1 there
+			if (d.opL==0xD) s.r[d.rX] = read_range(s,d.rX,pc) + reg_range::constant(-1);
+			jump = (d.rD==0xF);
+			break;
+		}
+		default: // OS calls exit or return, and anything else stops here
+			return false;
+		}
+		
+		s.r[0] = reg_range::constant(0); // writes to the zero register are discarded
+		
+		// Any register holding a constant might be used as a code address later
+		for (int r=1;r<0xF;r++)
+			if (s.r[r].lo==s.r[r].hi && s.r[r].lo>=0 && s.r[r].lo<(long)addr_taken.size())
+				addr_taken[s.r[r].lo]=1;
+		
+		if (jump) {
+			jump_ranges[pc] = s.r[0xF];
+			if (known_jump(pc)) // really a direct jump
+				return changed | merge_range(s.r[0xF].lo,s);
+			
+			// Indirect jump: can go to any address taken within the range,
+			//   and is merged into those jump table entries later.
+			long lo = std::max(0L,s.r[0xF].lo), hi = std::min((long)is_target.size()-1,s.r[0xF].hi);
+			if (lo<=hi) { target_cover[lo]++; target_cover[hi+1]--; }
+			
+			if (!jumped.reached) jumped = s;
+			else for (int r=0;r<16;r++) jumped.r[r] = jumped.r[r].join(s.r[r]);
+			return changed;
+		}
+		return changed | merge_range(pc+1,s);
+	}
+	
+	// Find the range of values each register can take at each instruction,
+	//   and where each indirect jump might go.
+	//   Execution starts at each of the entries pcs.  If resume is true, 
+	//   the registers could hold anything there.
+	//
+	//  Code addresses used by indirect jumps are assumed to have been
+	//   constants in a register at some point (like return addresses, or
+	//   jump targets loaded with an add).  Set all_targets if your program
+	//   computes jump targets some other way.
+	void analyze_ranges(const inst_t *inst,int n_inst,const std::vector<reg_t> &entries,bool resume)
+	{
+		ranges_in.assign(n_inst+1,range_state()); // +1 for falling off the end
+		mem_ranges.assign(n_inst,reg_range());
+		jump_ranges.assign(n_inst,reg_range());
+		is_call.assign(n_inst,0);
+		addr_taken.assign(n_inst,0);
+		is_target.assign(n_inst,all_targets?1:0);
+		merges.assign(n_inst+1,0);
+		
+		// Machine state at startup
+		range_state entry;
+		entry.reached=true;
+		for (int r=0;r<16;r++) entry.r[r]=reg_range::constant(0);
+		entry.r[1]=reg_range(); // argument
+		entry.r[reg_stack]=reg_range::constant(memsize - stacksize);
+		if (resume) // registers could be anything
+			for (int r=1;r<16;r++) entry.r[r]=reg_range();
+		for (reg_t pc : entries) merge_range(pc,entry);
+		
+		range_state jumped; // state at any indirect jump through rFjump
+		bool changed=true;
+		while (changed) {
+			changed=false;
+			target_cover.assign(n_inst+1,0);
+			for (int pc=0;pc<n_inst;pc++)
+				if (ranges_in[pc].reached)
+					changed |= step_range(pc,inst[pc],ranges_in[pc],jumped);
+			
+			// Indirect jumps can reach any taken address in their range
+			int cover=0;
+			for (int pc=0;pc<n_inst;pc++) {
+				cover += target_cover[pc];
+				if (cover>0 && addr_taken[pc]) is_target[pc]=1;
+			}
+			
+			if (jumped.reached) // rFjump can reach any indirect target
+				for (int pc=0;pc<n_inst;pc++)
+					if (is_target[pc])
+						changed |= merge_range(pc,jumped);
+		}
+	}
+	
+	
+	// Regions: the program is split into regions, each translated to its
+	//   own LLVM function, so huge programs don't become one huge function.
+	//   A region grows from a seed (the start, a called function, or an
+	//   indirect jump target) along direct jumps, but not into calls.
+	enum { max_region=1000 }; // most instructions in one region
+	std::vector<int> region_of; // region number for each pc, or -1 if unreachable
+	std::vector<reg_t> region_start; // seed pc for each region
+	std::vector<std::vector<reg_t> > region_pcs; // pcs in each region, in order
+	std::vector<char> is_entry; // 1 if we can enter a region at this pc
+	
+	// List where control goes after the instruction at pc, not counting
+	//   indirect jumps.  Calls only list the callee if with_calls is set.
+	void successors(const inst_t *inst,reg_t pc,std::vector<reg_t> &succ,bool with_calls)
+	{
+		decoded_t d(inst[pc]);
+		switch(d.opG) {
+		case 0x7: case 0x8: case 0xA: case 0xB: case 0xE:
+			if (d.rD!=0xF) succ.push_back(pc+1);
+			else if (known_jump(pc)) succ.push_back(jump_ranges[pc].lo);
+			break;
+		case 0xC:
+			succ.push_back(pc+1); // no swap, or return from a call
+			if (d.rD!=0xF && d.rD!=0x0) break; // swap doesn't touch the PC
+			if (known_jump(pc) && (with_calls || !is_call[pc]))
+				succ.push_back(jump_ranges[pc].lo);
+			break;
+		default: break;
+		}
+	}
+	
+	// Split the reachable part of the program into regions
+	void find_regions(const inst_t *inst,int n_inst,const std::vector<reg_t> &entries)
+	{
+		region_of.assign(n_inst,-1);
+		region_start.clear();
+		is_entry.assign(n_inst,0);
+		
+		// Seeds: entry points, then called functions, then indirect targets
+		std::vector<reg_t> seeds(entries);
+		std::vector<reg_t> succ;
+		for (int pc=0;pc<n_inst;pc++)
+			if (is_call[pc] && ranges_in[pc].reached && known_jump(pc))
+				seeds.push_back(jump_ranges[pc].lo);
+		for (int pc=0;pc<n_inst;pc++)
+			if (is_target[pc]) seeds.push_back(pc);
+		
+		for (size_t s=0;s<seeds.size();s++) {
+			reg_t seed = seeds[s];
+			if (seed<0 || seed>=n_inst || region_of[seed]!=-1 || !ranges_in[seed].reached) 
+				continue;
+			int region = region_start.size();
+			region_start.push_back(seed);
+			
+			// Depth-first search along direct jumps
+			int size=0;
+			std::vector<reg_t> work(1,seed);
+			while (!work.empty()) {
+				reg_t pc = work.back(); work.pop_back();
+				if (region_of[pc]!=-1) continue;
+				if (size>=max_region) { seeds.push_back(pc); continue; } // start a new region
+				region_of[pc]=region;
+				size++;
+				succ.clear();
+				successors(inst,pc,succ,false);
+				for (reg_t next : succ)
+					if (next>=0 && next<n_inst && region_of[next]==-1)
+						work.push_back(next);
+			}
+		}
+		
+		// Entries: seeds, indirect targets, and anything jumped to from another region
+		region_pcs.assign(region_start.size(),std::vector<reg_t>());
+		for (reg_t seed : region_start) is_entry[seed]=1;
+		for (int pc=0;pc<n_inst;pc++) {
+			if (region_of[pc]==-1) continue;
+			region_pcs[region_of[pc]].push_back(pc);
+			if (is_target[pc]) is_entry[pc]=1;
+			succ.clear();
+			successors(inst,pc,succ,true);
+			for (reg_t next : succ)
+				if (next>=0 && next<n_inst && region_of[next]!=region_of[pc])
+					is_entry[next]=1;
+		}
+	}
+
+	// Liveness: registers keep their values in LLVM variables along
+	//   straight-line code, and only get stored when leaving it, if
+	//   something might read them.  So LLVM gets far fewer loads and
+	//   stores to clean up.
+	bool preoptimize=true; // if false, load and store registers every time
+	std::vector<uint16_t> live_in, live_out; // bit r set if register r might be read later
+	std::vector<char> straight; // 1 if pc is only reached by falling through from pc-1
+	std::string reg_value[16]; // LLVM value each register holds here, or ""
+	uint16_t dirty=0; // bit r set if reg_value[r] hasn't been stored yet
+	bool jumps_indirect=false; // set if this region has an indirect jump
+	
+	void forget_regs() {
+		for (int r=0;r<16;r++) reg_value[r]="";
+		dirty=0;
+	}
+	
+	// Return true if this instruction always goes on to the next one
+	static bool falls_through(const decoded_t &d) {
+		switch(d.opG) {
+		case 0x7: case 0x8: case 0xA: case 0xB: case 0xE: return d.rD!=0xF;
+		default: return false;
+		}
+	}
+	
+	// Registers this instruction reads (use) and always overwrites (def),
+	//   not counting r0 and the PC, which never get loaded.
+	static void reg_use_def(const decoded_t &d,uint16_t &use,uint16_t &def) {
+		use=def=0;
+		switch(d.opG) {
+		case 0x7: case 0x8: case 0xA: case 0xB:
+			use = (1<<d.rX) | (1<<d.rY);
+			def = 1<<d.rD;
+			break;
+		case 0xC: // the swap is conditional, so it doesn't always overwrite
+			use = (1<<d.rX) | (1<<d.rY) | (1<<d.rD) | (1<<(0xF & (d.rD-1)));
+			break;
+		case 0xE:
+			use = (1<<d.rX) | (1<<d.rY) | (1<<d.rD);
+			def = 1<<d.rD;
+			break;
+		case 0xF:
+			if (d.opL==0xF) use = 1<<d.rD;
+			break;
+		}
+		use &= 0x7FFE;
+		def &= 0x7FFE;
+	}
+	
+	// Find the registers live after each instruction, and the straight-line code.
+	//   Indirect jumps could go anywhere (including back to the interpreter),
+	//   so every register is live there.
+	void analyze_liveness(const inst_t *inst,int n_inst)
+	{
+		live_out.assign(n_inst,0);
+		live_in.assign(n_inst,0);
+		std::vector<int> preds(n_inst,0);
+		std::vector<reg_t> succ;
+		bool changed=true;
+		while (changed) {
+			changed=false;
+			for (int pc=n_inst-1;pc>=0;pc--) {
+				if (!ranges_in[pc].reached) continue;
+				decoded_t d(inst[pc]);
+				uint16_t out=0, use, def;
+				bool writes_pc = d.rD==0xF || (d.opG==0xC && d.rD==0x0);
+				if (writes_pc && d.opG!=0xF && !known_jump(pc)) out=0x7FFE;
+				succ.clear();
+				successors(inst,pc,succ,true);
+				for (reg_t next : succ)
+					if (next>=0 && next<n_inst) out |= live_in[next];
+				reg_use_def(d,use,def);
+				uint16_t in = use | (out & ~def);
+				if (out!=live_out[pc] || in!=live_in[pc]) changed=true;
+				live_out[pc]=out;
+				live_in[pc]=in;
+			}
+		}
+		
+		for (int pc=0;pc<n_inst;pc++) {
+			if (!ranges_in[pc].reached) continue;
+			succ.clear();
+			successors(inst,pc,succ,true);
+			for (reg_t next : succ)
+				if (next>=0 && next<n_inst) preds[next]++;
+		}
+		straight.assign(n_inst,0);
+		for (int pc=1;pc<n_inst;pc++)
+			straight[pc] = preds[pc]==1 && !is_entry[pc] && !is_target[pc]
+				&& ranges_in[pc-1].reached && falls_through(decoded_t(inst[pc-1]));
+	}
+	
+	void translate(inst_t inst)
+	{
+		// Decode bits of machine code instruction
+		decoded_t d(inst);
+		inst_t opG=d.opG, opL=d.opL, rD=d.rD, rX=d.rX, rY=d.rY;
+		reg_t c=d.c;
+		
+		// Execute instruction
+		switch(opG) {
+		case 0x7: // / divide:
+			switch (opL) {
+			case 0x0: emit_arith("sdiv", rD, rX, rY, c);
+				//regs[rD] = regs[rX] / (regs[rY] + c); 
+				break;
+			case 0x1: emit_arith("srem", rD, rX, rY, c);
+				//regs[rD] = regs[rX] % (regs[rY] + c); 
+				break;
+			default: fatal(inst,"Unknown opL in divide");
+			}
+			break;
+		case 0x8: // x multiply:
+			emit_arith("mul", rD, rX, rY, c);
+			//regs[rD] = regs[rX] * (regs[rY] + c);
+			break;
+		case 0xA: // + Add:
+			emit_arith("add", rD, rX, rY, c);
+			// regs[rD] = regs[rX] + (regs[rY] + c);
+			break;
+		case 0xB: // - suBtract:
+			emit_arith("sub", rD, rX, rY, c);
+			//regs[rD] = regs[rX] - (regs[rY] + c);
+			break;
+
+		case 0xC: // Conditional swap:
+			emit_cswap("icmp slt", rD, rX, rY, c);
+			/*
+			if (regs[rX] < ( regs[rY] + c ))
+			{
+				std::swap(regs[rD],regs[rD-1]);
+			}
+			*/
+			break;
+		case 0xE: // mEmory access, including the stack
+			if ((opL==0x1 || opL==0xD) && rX==0xF) fatal(inst,"Can't push/pop the PC");
+			emit_mem(opL, rD, rX, rY, c);
+			/*
+				if (opL==1) regs[rX]++; // pre-increment (push, ++pointer)
+				
+				reg_t addr = regs[rX] + regs[rY] + c;
+				if (addr<0 || addr>=memsize) fatal(inst,"Bad mem addr");
+				std::swap(regs[rD],mem[ addr ]);
+				
+				if (opL==0xD) regs[rX]--; // post-decrement (pop, pointer--)
+			*/
+			break;
+		case 0xF: // OS calls
+			switch(opL) {
+			case 0x0: //exit(1); 
+				{
+					std::string id = start_inst();
+					emit()<<"  br label %exit \n";
+				}
+				break;
+			
+			case 0xF: // print
+				//printf("0x%08x  %d\n", regs[rD], regs[rD]);
+				{
+					std::string id = start_inst();
+					std::string D = load_reg(rD,"%D"+id);
+					emit()<<"  store i32 -1, i32 * %rFptr, align 4 ; program is done\n";
+					emit()<<"  ret i32 "+D+"\n";
+				}
+				break;
+			default:
+				fatal(inst,"Unknown opL in OS call");
+			};
+			break;
+		default:
+			fatal(inst,"Unknown opG");
+		}
+	}
+	
+	// Analyze the program and split it into regions, starting at these entries
+	void prepare(const inst_t *inst,int n_inst,const std::vector<reg_t> &entries,bool resume)
+	{
+		pc_digits=2;
+		while ((1L<<(4*pc_digits)) <= n_inst) pc_digits++;
+		
+		// Find the possible register values at each instruction
+		analyze_ranges(inst,n_inst,entries,resume);
+		target_list.clear();
+		for (int pc=0;pc<n_inst;pc++)
+			if (is_target[pc]) target_list.push_back(pc);
+		find_regions(inst,n_inst,entries);
+		analyze_liveness(inst,n_inst);
+		
+		// Set up machine
+		sysregs[sysreg_heapstart] = n_inst; // heap starts after code
+		regs[reg_stack]=memsize - stacksize; // stack is at end of memory
+	}
+	
+	// Return the LLVM function name for this region
+	std::string region_name(int region) {
+		return "@region"+hex_pc(region_start[region]);
+	}
+	
+	// Emit one region as an LLVM function.  It loads the registers from regs,
+	//   starts at regs[reg_pc], and runs until the code leaves the region.
+	//   Then it stores the registers back, with the next pc in regs[reg_pc]
+	//   (or -1 if the program is done, and the return value is the result).
+	void translate_region(const inst_t *inst,int n_inst,int region,
+		const std::string &linkage="")
+	{
+		cur_region=region;
+		out_stubs.clear();
+		chain_stubs.clear();
+		emit()<<"define "+linkage+"i32 "+region_name(region)+"(i32 * %regs, i32 * %mem)"
+			+debug_function(region_name(region).substr(1),region_start[region])+" {\n";
+		
+		// Create a zero constant
+		emit()<<"  %zero = add i32 0,0\n";
+		
+		// Reserve space for all the (mutable) registers, and copy the caller's 
+		//   values (only the ones we might read, and always the PC)
+		uint16_t live_entry = 0xFFFF;
+		if (preoptimize) {
+			live_entry = 1<<reg_pc;
+			for (reg_t i : region_pcs[region])
+				if (is_entry[i]) live_entry |= live_in[i];
+		}
+		for (int r=1;r<=0xF;r++) {
+			std::string ptr = "%r"+hex(r,1)+"ptr";
+			std::string value = "%r"+hex(r,1)+"init";
+			emit()<<"  "+reg_addr(r)+" = alloca i32, align 4\n";
+			emit()<<"  "+ptr+" = getelementptr i32, i32 * %regs, i32 "<<r<<"\n";
+			if (!(live_entry & (1<<r))) continue;
+			emit()<<"  "+value+" = load i32, i32 * "+ptr+", align 4\n";
+			emit()<<"  store i32 "+value+", i32 *"+reg_addr(r)+", align 4\n";
+		}
+		jumps_indirect=false;
+		emit()<<"  br label %rFjump; start at caller's PC\n";
+		
+		// Translate each instruction in this region
+		for (reg_t i : region_pcs[region]) 
+		{
+			if (!straight[i]) forget_regs(); // values from other paths don't reach here
+			inst_t fetch = inst[i];
+			char trace[80];
+			snprintf(trace,sizeof(trace),";                     TRACE %03x: %08x\n",
+				i, fetch);
+			emit()<<trace;
+			regs[reg_pc] = i+1; //<- real machine has moved to next instruction
+			
+			debug_at(i);
+			translate(fetch);
+		}
+		debug_at(region_start[region]); // the way out belongs to the region
+		
+		// Jumps to other regions store the new PC and leave
+		for (reg_t pc : out_stubs) {
+			emit()<<"out"+hex_pc(pc)+":\n";
+			emit()<<"  store i32 "<<pc<<", i32 * %rFaddr, align 4\n";
+			emit()<<"  br label %leave\n";
+		}
+		// Registers the next region might read (indirect jumps could go anywhere)
+		uint16_t live_exit = 0xFFFF;
+		if (preoptimize && !jumps_indirect) {
+			live_exit = 1<<reg_pc;
+			for (reg_t pc : out_stubs) live_exit |= live_in[pc];
+		}
+		emit()<<"\nleave: ; copy registers back for the next region\n";
+		copy_back(live_exit,"");
+		emit()<<"  ret i32 0\n\n";
+		
+		// Inline cache hits in other regions skip the dispatcher, and
+		//   go straight to the target's region
+		for (reg_t pc : chain_stubs) {
+			std::string id = hex_pc(pc);
+			emit()<<"chain"+id+": ; rF is "<<pc<<"\n";
+			copy_back(live_exit,id);
+			emit()<<"  %chained"+id+" = musttail call i32 "+region_name(region_of[pc])+"(i32 * %regs, i32 * %mem)\n";
+			emit()<<"  ret i32 %chained"+id+"\n\n";
+		}
+		
+		// Crash handling
+		emit()<<"exit: ; fail and exit\n";
+		emit()<<"  store i32 -1, i32 * %rFptr, align 4\n";
+		emit()<<"  ret i32 -999\n\n";
+		
+		// Indirect jump table: only the ways into this region
+		emit()<<"rFjump: ; indirect jump table\n";
+		emit()<<"  %target = load i32, i32 *%rFaddr, align 4\n";
+		emit()<<"  switch i32 %target, label %leave [ ";
+		for (reg_t i : region_pcs[region]) {
+			if (is_entry[i])
+				emit()<<"  i32 "<<i<<", label %"<<label_pc(i)<<"  ";
+		}
+		emit()<<" ]\n\n";
+		
+		emit()<<"}\n\n";
+		
+		if (separate_modules) { // the regions we chain to are in other modules
+			std::set<int> chained;
+			for (reg_t pc : chain_stubs) chained.insert(region_of[pc]);
+			for (int r : chained)
+				emit()<<"declare i32 "+region_name(r)+"(i32 *, i32 *)\n";
+		}
+	}
+	
+	// Copy these registers back to the caller's regs, naming values with id
+	void copy_back(uint16_t live,const std::string &id) {
+		for (int r=1;r<=0xF;r++) {
+			if (!(live & (1<<r))) continue;
+			std::string value = "%r"+hex(r,1)+"out"+id;
+			emit()<<"  "+value+" = load i32, i32 * "+reg_addr(r)+", align 4\n";
+			emit()<<"  store i32 "+value+", i32 * %r"+hex(r,1)+"ptr, align 4\n";
+		}
+	}
+	
+	// Emit the dispatcher, which calls regions until the program is done.
+	//   If resume is false, it's jitentry(arg0,mem), which sets up the 
+	//   registers and starts at pc start.  If resume is true, it's 
+	//   jitresume(regs,mem), which starts at regs[reg_pc], and if it hits
+	//   a pc we didn't translate, returns with that pc in regs[reg_pc].
+	void translate_dispatcher(int n_inst,bool resume,reg_t start,bool declare)
+	{
+		// Tell the caller how much memory to pass us
+		emit()<<"@jitmemsize = constant i32 "<<memsize<<"\n\n";
+		
+		if (declare) // regions are in other modules
+			for (size_t r=0;r<region_start.size();r++)
+				emit()<<"declare i32 "+region_name(r)+"(i32 *, i32 *)\n";
+		
+		if (resume) {
+			emit()<<"\ndefine i32 @jitresume(i32 * %regs, i32 * %mem)"
+				+debug_function("jitresume",start)+" {\n";
+		}
+		else {
+			emit()<<"\ndefine i32 @jitentry(i32 %arg0, i32 * %mem)"
+				+debug_function("jitentry",start)+" {\n";
+			emit()<<"  %regs = alloca i32, i32 16, align 4\n";
+			for (int r=0;r<=0xF;r++) {
+				std::string value = "0"; // initial value for this register
+				if (r==1) value = "%arg0"; // copy argument into register
+				if (r==reg_stack) value = std::to_string(memsize - stacksize); // stack is at end of memory
+				if (r==reg_pc) value = std::to_string(start);
+				emit()<<"  %r"+hex(r,1)+"ptr = getelementptr i32, i32 * %regs, i32 "<<r<<"\n";
+				emit()<<"  store i32 "+value+", i32 * %r"+hex(r,1)+"ptr, align 4\n";
+			}
+		}
+		emit()<<"  br label %dispatch\n\n";
+		
+		emit()<<"dispatch: ; call the region for regs[reg_pc]\n";
+		emit()<<"  %pcptr = getelementptr i32, i32 * %regs, i32 "<<reg_pc<<"\n";
+		emit()<<"  %pc = load i32, i32 * %pcptr, align 4\n";
+		emit()<<"  switch i32 %pc, label %unknown [ ";
+		for (int i=0;i<n_inst;i++) {
+			if (region_of[i]!=-1 && is_entry[i])
+				emit()<<"  i32 "<<i<<", label %call"<<region_of[i]<<"  ";
+		}
+		emit()<<" ]\n\n";
+		
+		for (size_t r=0;r<region_start.size();r++) {
+			std::string id = std::to_string(r);
+			emit()<<"call"+id+":\n";
+			emit()<<"  %v"+id+" = call i32 "+region_name(r)+"(i32 * %regs, i32 * %mem)\n";
+			emit()<<"  %f"+id+" = load i32, i32 * %pcptr, align 4\n";
+			emit()<<"  %d"+id+" = icmp eq i32 %f"+id+", -1\n";
+			emit()<<"  br i1 %d"+id+", label %done, label %dispatch\n";
+		}
+		
+		if (region_start.size()>0) {
+			emit()<<"\ndone: ; program finished\n";
+			emit()<<"  %result = phi i32 ";
+			for (size_t r=0;r<region_start.size();r++)
+				emit()<<(r>0?", ":"")<<"[ %v"<<r<<", %call"<<r<<" ]";
+			emit()<<"\n  ret i32 %result\n";
+		}
+		
+		emit()<<"\nunknown: ; jump to a pc we didn't translate\n";
+		if (resume)
+			emit()<<"  ret i32 0 ; caller can take it from here\n";
+		else
+			emit()<<"  ret i32 -999\n";
+		emit()<<"}\n";
+	}
+	
+	// Translate this program into one LLVM module, with a jitentry(arg0,mem)
+	//   function that runs the program starting at pc start.
+	void translate(const inst_t *inst,int n_inst,int count=1000,reg_t start=0)
+	{
+		prepare(inst,n_inst,std::vector<reg_t>(1,start),false);
+		separate_modules=false;
+		begin_module();
+		for (size_t r=0;r<region_start.size();r++)
+			translate_region(inst,n_inst,r,"internal ");
+		translate_dispatcher(n_inst,false,start,false);
+		end_module();
+	}
+	
+	// Translate this program into separate LLVM modules, so they can be
+	//   compiled in parallel.  The first module has a jitresume(regs,mem)
+	//   dispatcher, which can start at any of these entries, and the rest
+	//   are the regions.
+	std::vector<std::string> translate_modules(const inst_t *inst,int n_inst,
+		const std::vector<reg_t> &entries)
+	{
+		std::vector<std::string> modules;
+		std::ostream *old_out=out;
+		prepare(inst,n_inst,entries,true);
+		separate_modules=true;
+		
+		std::ostringstream dispatcher;
+		out=&dispatcher;
+		begin_module();
+		translate_dispatcher(n_inst,true,0,true);
+		end_module();
+		modules.push_back(dispatcher.str());
+		
+		for (size_t r=0;r<region_start.size();r++) {
+			std::ostringstream region;
+			out=&region;
+			begin_module();
+			translate_region(inst,n_inst,r);
+			end_module();
+			modules.push_back(region.str());
+		}
+		out=old_out;
+		return modules;
+	}
+	
+	
+	
+	/**************** Fast interpreter *****************/
+	std::vector<decoded_t> code; // the program, decoded once up front
+	std::vector<unsigned int> jump_counts; // times each pc was jumped to
+	std::vector<reg_t> jump_last; // last target jumped to from each pc, or -1
+	reg_t exit_value=0; // value printed when the program exits
+	
+	// Set up the machine to run this program, with this argument in r1
+	void load(const inst_t *inst,int n_inst,reg_t arg0,reg_t start=0)
+	{
+		if (!memory) {
+			memory.reset(new guarded_memory(memsize, bad_address, this));
+			mem = memory->data;
+		}
+		code.assign(inst,inst+n_inst);
+		jump_counts.assign(n_inst,0);
+		jump_last.assign(n_inst,-1);
+		for (int i=0;i<n_inst && i<memsize;i++) mem[i]=inst[i]; // code is in memory too
+		
+		for (int r=0;r<16;r++) regs[r]=0;
+		regs[1]=arg0;
+		sysregs[sysreg_heapstart] = n_inst; // heap starts after code
+		regs[reg_stack]=memsize - stacksize; // stack is at end of memory
+		regs[reg_pc]=start;
+	}
+	
+	enum run_status {
+		run_exit=0, // program finished, result is in exit_value
+		run_hot=1 // paused right after a jump, at regs[reg_pc]
+	};
+	
+	// Interpret instructions until the program exits, or until a jump lands
+	//   on a target that has now been jumped to hot_threshold times.  
+	//   Also pauses at any jump once *stop is set (if non-NULL).
+	run_status run(unsigned int hot_threshold=0,const std::atomic<bool> *stop=0)
+	{
+		const reg_t n_inst = code.size();
+		while (true) {
+			reg_t pc = regs[reg_pc];
+			if (pc<0 || pc>=n_inst) fatal(0,"Jump outside program");
+			regs[reg_pc] = pc+1; //<- real machine has moved to next instruction
+			
+			if (execute(code[pc])) return run_exit;
+			
+			reg_t target = regs[reg_pc];
+			if (target!=pc+1) { // we jumped
+				jump_last[pc] = target;
+				if (target>=0 && target<n_inst && ++jump_counts[target]==hot_threshold)
+					return run_hot;
+				if (stop && stop->load(std::memory_order_relaxed))
+					return run_hot;
+			}
+		}
+	}
+	
+	// Wraparound 32-bit arithmetic, like the hardware (and LLVM's add/mul)
+	static reg_t wrap_add(reg_t a,reg_t b) { return (reg_t)((uint32_t)a + (uint32_t)b); }
+	static reg_t wrap_sub(reg_t a,reg_t b) { return (reg_t)((uint32_t)a - (uint32_t)b); }
+	static reg_t wrap_mul(reg_t a,reg_t b) { return (reg_t)((uint32_t)a * (uint32_t)b); }
+	
+	// Execute one instruction.  Returns true if the program exits.
+	bool execute(const decoded_t &d)
+	{
+		reg_t *r = regs;
+		switch(d.opG) {
+		case 0x7: { // / divide:
+			reg_t y = wrap_add(r[d.rY], d.c);
+			if (y==0) fatal(d.inst,"Divide by zero");
+			switch (d.opL) {
+			case 0x0: r[d.rD] = r[d.rX] / y; break;
+			case 0x1: r[d.rD] = r[d.rX] % y; break;
+			default: fatal(d.inst,"Unknown opL in divide");
+			}
+			break;
+		}
+		case 0x8: // x multiply:
+			r[d.rD] = wrap_mul(r[d.rX], wrap_add(r[d.rY], d.c));
+			break;
+		case 0xA: // + Add:
+			r[d.rD] = wrap_add(r[d.rX], wrap_add(r[d.rY], d.c));
+			break;
+		case 0xB: // - suBtract:
+			r[d.rD] = wrap_sub(r[d.rX], wrap_add(r[d.rY], d.c));
+			break;
+		case 0xC: // Conditional swap:
+			if (r[d.rX] < wrap_add(r[d.rY], d.c))
+				std::swap(r[d.rD], r[0xF & (d.rD-1)]);
+			break;
+		case 0xE: { // mEmory access, including the stack
+			if (d.opL==1) r[d.rX]++; // pre-increment (push, ++pointer)
+			
+			reg_t addr = wrap_add(r[d.rX], wrap_add(r[d.rY], d.c));
+			std::swap(r[d.rD],mem[ addr ]); // bad addresses hit the guard pages
+			
+			if (d.opL==0xD) r[d.rX]--; // post-decrement (pop, pointer--)
+			break;
+		}
+		case 0xF: // OS calls
+			switch(d.opL) {
+			case 0x0: exit_value = -999; return true; // same as translated exit
+			case 0xF: exit_value = r[d.rD]; return true; // print and exit
+			default: fatal(d.inst,"Unknown opL in OS call");
+			};
+			break;
+		default:
+			fatal(d.inst,"Unknown opG");
+		}
+		r[0] = 0; // zero register stays zero
+		return false;
+	}
+};
+
+// Read a RevRISC program from a binary file of little-endian 32-bit instructions
+inline std::vector<inst_t> read_program(const char *filename)
+{
+	std::ifstream f(filename,std::ios::binary);
+	if (!f) {
+		printf("Fatal error: can't open program file %s\n",filename);
+		exit(1);
+	}
+	std::vector<inst_t> program;
+	unsigned char b[4];
+	while (f.read((char *)b,4))
+		program.push_back(b[0] | (b[1]<<8) | (b[2]<<16) | ((inst_t)b[3]<<24));
+	return program;
+}
+
+// Write a listing of this program with one instruction per line, so
+//  line pc+1 is the instruction at pc, like the debug info says.
+inline bool write_listing(const inst_t *inst,int n_inst,const std::string &filename)
+{
+	FILE *f = fopen(filename.c_str(),"w");
+	if (!f) return false;
+	for (int pc=0;pc<n_inst;pc++)
+		fprintf(f,"%03x: %08x\n",pc,inst[pc]);
+	fclose(f);
+	return true;
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*
+  Tiered execution of RevRISC machine code.
+
+  Programs start running right away in the fast interpreter, which counts
+  the jumps to each target.  Once a jump target gets hot, a background
+  thread translates the program to LLVM IR and compiles it with ORC,
+  one module per region, in parallel.  Each indirect jump first checks
+  for the targets it is likely to take, like the one the interpreter
+  last saw, and goes straight there.  When the native code is ready,
+  the interpreter hands over its registers and memory at the next jump
+  to the hot target.  (That's the only entry translated for any register
+  values: other entries, like called functions, assume what the analysis
+  saw at their call sites, like the return address.)  If the native code jumps somewhere it wasn't
+  compiled for, it hands the machine back to the interpreter.
+
+  Short runs never pay for LLVM, and long runs get native speed.
+
+  Run with:
+    ./revrisc_tiered [ -perf ] [ n ] [ program.bin ]
+
+  -perf describes the native code to Linux perf (see README.md), with
+  debug info mapping it back to the lines of program.bin.lst (or 
+  revrisc.lst), a listing with one RevRISC instruction per line.
+
+  Dr. Orion Lawlor and the CS 601 class, 2024-02 (Public Domain)
+*/
+#include <thread>
+#include <sstream>
+#include <chrono>
+#include "revrisc.h"
+#include "example_jit.h"
+
+typedef RevRISC_interpreter<1024*1024,16> machine_t;
+
+// Native code made by translate_modules: starts at regs[reg_pc], and 
+//    returns the exit value, or returns with a pc to interpret from.
+typedef reg_t (*native_fn)(reg_t *regs, mem_t *mem);
+
+// Seconds since some arbitrary start point
+double time_now(void) {
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Runs a program in the interpreter, and switches to native code once
+//   it has been compiled.
+class tiered_runner {
+public:
+	unsigned int hot_threshold=1000; // jumps to one target before we compile
+	bool perf=false; // tell perf about the native code, with debug info
+
+	tiered_runner() :cpu(new machine_t()), translator(new machine_t()) {
+		translator->guard_pages=true; // native code runs on cpu's guarded memory
+	}
+	~tiered_runner() {
+		if (compiler.joinable()) compiler.join();
+	}
+	
+	// Add debug info to the native code, with lines from this listing file
+	void debug(const std::string &listing) {
+		translator->debug_info=true;
+		translator->debug_file=listing;
+	}
+
+	// Run this program, with this argument in r1, and return its exit value
+	reg_t run(const inst_t *inst,int n_inst,reg_t arg0)
+	{
+		reg_t *regs = cpu->regs;
+		cpu->load(inst,n_inst,arg0);
+		while (cpu->run(hot_threshold,&ready) == machine_t::run_hot)
+		{
+			reg_t pc = regs[machine_t::reg_pc];
+			if (ready) { // native code is done: can we enter it here?
+				if (pc!=hot_pc) continue;
+				
+				fprintf(stderr,"Switching to native code at pc %03x\n",pc);
+				reg_t result = native(regs, cpu->mem);
+				if (regs[machine_t::reg_pc]==-1) return result; // program finished
+				fprintf(stderr,"Back to the interpreter at pc %03x\n",regs[machine_t::reg_pc]);
+			}
+			else if (!compiler.joinable()) { // first hot target: start compiling
+				fprintf(stderr,"Target %03x is hot, compiling\n",pc);
+				translator->jump_last = cpu->jump_last; // for the inline caches
+				hot_pc = pc;
+				compiler = std::thread(&tiered_runner::compile,this,inst,n_inst,pc);
+			}
+		}
+		return cpu->exit_value;
+	}
+
+private:
+	std::unique_ptr<machine_t> cpu; // runs the interpreter
+	std::unique_ptr<machine_t> translator; // translates (on the compiler thread)
+
+	std::thread compiler; // does the translation and compilation
+	std::unique_ptr<ExampleJIT> jit; // owns the native code
+	native_fn native=0; // the native code, once it's ready
+	std::atomic<bool> ready{false}; // set once native is ready to run
+	reg_t hot_pc=-1; // where native code can start, with any register values
+
+	// Translate and compile the program (runs on the compiler thread)
+	void compile(const inst_t *inst,int n_inst,reg_t hot_pc)
+	{
+		double start=time_now();
+		std::vector<std::string> modules = translator->translate_modules(
+			inst,n_inst,std::vector<reg_t>(1,hot_pc));
+
+		jit = std::make_unique<ExampleJIT>();
+		jit->setLazy(false); // compile it all here, not on the interpreter's thread
+		if (perf && !jit->enablePerf()) fprintf(stderr,"This LLVM doesn't support perf\n");
+		if (!*jit || !jit->addTexts(modules,"revrisc")) return;
+		native = (native_fn)jit->lookup("jitresume");
+		if (!native) return;
+
+		fprintf(stderr,"Compiled %d regions to native code in %.3f ms\n",
+			(int)modules.size()-1,(time_now()-start)*1.0e3);
+		ready.store(true); // publishes native to the interpreter thread
+	}
+};
+
+
+
+
+const static inst_t instructions[] = {
+// 0xOORRRCCC
+// sum of i*i for i from 0 to r1 (wraps around 32 bits)
+   0xA0200000, // 0: r2 = 0 (sum)
+   0xA0300000, // r3 = 0 (i)
+   0xA0F00006, // jump to loop compare first
+	   0x80433000, // 3: r4 = r3 * r3
+	   0xA0224000, // r2 = r2 + r4
+	   0xA0330001, // i++
+	   0xA0E00003, // 6: jump target to start of loop
+	   0xC0F31000, // keep looping while r3 < r1
+   0xFF200000, // print sum and exit
+};
+
+int main(int argc,char *argv[])
+{
+	bool perf = false;
+	if (argc>1 && std::string(argv[1])=="-perf") { perf = true; argc--; argv++; }
+	reg_t n = 100000000;
+	if (argc>1) n = atoi(argv[1]);
+
+	std::vector<inst_t> program(instructions, 
+		instructions+sizeof(instructions)/sizeof(inst_t));
+	std::string listing = "revrisc.lst";
+	if (argc>2) {
+		program = read_program(argv[2]);
+		listing = std::string(argv[2])+".lst";
+	}
+
+	tiered_runner runner;
+	if (perf) {
+		runner.perf = true;
+		runner.debug(listing);
+		if (!write_listing(program.data(), program.size(), listing))
+			fprintf(stderr,"Can't write listing %s\n",listing.c_str());
+	}
+	double start=time_now();
+	reg_t result = runner.run(program.data(), program.size(), n);
+	printf(" result %d (%08x) in %.3f ms\n", result, result, (time_now()-start)*1.0e3);
+	return 0;
+}
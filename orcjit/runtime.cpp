@@ -0,0 +1,44 @@
+/*
+Runtime library for JIT-compiled code (see runtime.h).
+
+Everything here gets inlined into JIT'd code that calls it, unless
+it's marked noinline, like print_hex.  To add a helper, declare it in
+runtime.h, define it here, and add it to CallableFuncs in example_jit.cpp
+so it also works without the bitcode.
+
+ * Dr. Orion Lawlor and the CS 601 class, 2024 (Public Domain)
+*/
+#include <stdio.h>
+#include "runtime.h"
+
+extern "C" {
+
+// Print this area as hexadecimal bytes
+__attribute__((noinline))
+void print_hex(void *ptr,int len)
+{
+    unsigned char *data=(unsigned char *)ptr;
+    printf("Code: \necho ");
+    for (int i=0;i<len;i++) printf("%02x ",data[i]);
+    printf(" | xxd -r -p | ndisasm -b 64 -\n\n");
+}
+
+// Print this long integer onscreen
+void print_long(long v) 
+{
+    printf(" long: %ld\n",v);
+}
+
+long jit_min(long a,long b) { return a<b ? a : b; }
+long jit_max(long a,long b) { return a>b ? a : b; }
+long jit_abs(long a) { return a<0 ? -a : a; }
+long jit_clamp(long v,long lo,long hi) { return jit_min(jit_max(v,lo),hi); }
+
+unsigned long jit_hash(unsigned long x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+    return x ^ (x >> 31);
+}
+
+}
@@ -0,0 +1,35 @@
+/*
+Runtime library for JIT-compiled code: small helpers that LLVM IR can
+call, like print_long or jit_min.
+
+runtime.cpp is compiled into the host program, so ExampleJIT can always
+resolve these functions by address.  It's also compiled to LLVM bitcode
+(runtime.bc, see the Makefile), and ExampleJIT::setRuntime links that
+bitcode into each module before optimization, so calls to these
+functions get inlined into the JIT'd code.
+
+ * Dr. Orion Lawlor and the CS 601 class, 2024 (Public Domain)
+*/
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+extern "C" {
+
+// Print this area as hexadecimal bytes
+void print_hex(void *ptr,int len);
+
+// Print this long integer onscreen
+void print_long(long v);
+
+// Small math helpers, meant to be inlined into loops
+long jit_min(long a,long b);
+long jit_max(long a,long b);
+long jit_abs(long a);
+long jit_clamp(long v,long lo,long hi);
+
+// Mix up the bits of x (the splitmix64 finalizer)
+unsigned long jit_hash(unsigned long x);
+
+}
+
+#endif